@@ -6,6 +6,33 @@
 #include <map>
 #include <sstream>
 #include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <climits>
+#include <set>
+#include <string_view>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <random>
+#include <arpa/inet.h>
+#include <csignal>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -17,7 +44,14 @@ const string APP_FILE = "appointments.txt";
 const string DOC_PRIMARY_INDEX_FILE = "doctor_primary_index.txt";
 const string DOC_SECONDARY_INDEX_FILE = "doctor_secondary_index.txt";
 const string APP_PRIMARY_INDEX_FILE = "appointment_primary_index.txt";
+const string DOC_PRIMARY_INDEX_TREE_FILE = "doctor_primary_index.bpt";
+const string APP_PRIMARY_INDEX_TREE_FILE = "appointment_primary_index.bpt";
 const string APP_SECONDARY_INDEX_FILE = "appointment_secondary_index.txt";
+const string INDEX_LOG_FILE = "index_delta.log";
+const string INDEX_SNAPSHOT_FILE = "indices.snap";
+
+// Number of logged index changes after which saveAllIndices() writes a new checkpoint
+const size_t CHECKPOINT_THRESHOLD = 1000;
 
 // Structures
 struct Doctor {
@@ -32,974 +66,5818 @@ struct Appointment {
     string date;
 };
 
-// Indexes
-map<string, long> doctorPrimaryIndex;
-map<string, vector<string>> doctorSecondaryIndex;
-map<string, long> appointmentPrimaryIndex;
-map<string, vector<string>> appointmentSecondaryIndex;
-map<long, size_t> doc_availList;
-map<long, size_t> app_availList;
+// Zero-copy views of a record's fields, pointing into the mapped data file
+struct DoctorView {
+    string_view id;
+    string_view name;
+    string_view address;
+};
 
-// Function Prototypes
-void loadAllIndices();
-void saveAllIndices();
-void loaddoc_availList();
-void loadApp_availList();
-void savedoc_availList();
-void saveApp_availList();
-void addDoctor();
-void searchDoctorByID(const string& doctorId);
-void searchDoctorByName(const string& name);
-void deleteDoctor(const string& doctorId);
-void deleteAppointment(const string& appointmentId);
-void addAppointment();
-void searchAppointmentByID(const string& appointmentId);
-void searchAppointmentByDoctor(const string& doctorId);
-void menu();
+struct AppointmentView {
+    string_view id;
+    string_view date;
+    string_view doctorId;
+};
 
-// Helper function to write length indicator and delimited fields without newline
-void writeDelimitedRecord(fstream &file, const string& record, size_t availableSize) {
-    string newRecord = to_string(record.length()) + "|" + record;
+// 64-bit FNV-1a hash, the checksum of the tree journals and of the index snapshot; hash
+// continues the checksum of the bytes before data
+uint64_t checksum(const char* data, size_t size, uint64_t hash = 1469598103934665603ULL) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
 
-    // Pad the record with spaces or zeros to completely overwrite the deleted space
-    if (newRecord.size() < availableSize) {
-        newRecord.append(availableSize - newRecord.size(), ' '); 
-        cout<<"New Record"<<newRecord<<"\n"; // Fill remaining space
-    } 
+// Paged B+-tree index layout. Page 0 is the header; every other page is a node.
+const size_t BPT_PAGE_SIZE = 4096;
+const size_t BPT_KEY_SIZE = 32;               // one length byte + up to 31 key bytes
+const size_t BPT_MAX_KEY = BPT_KEY_SIZE - 1;
+const size_t BPT_NODE_HEADER = 16;            // isLeaf, count, next leaf / first child
+const size_t BPT_LEAF_ENTRY = BPT_KEY_SIZE + sizeof(int64_t);
+const size_t BPT_INTERNAL_ENTRY = BPT_KEY_SIZE + sizeof(uint32_t);
+const size_t BPT_LEAF_CAPACITY = (BPT_PAGE_SIZE - BPT_NODE_HEADER) / BPT_LEAF_ENTRY;
+const size_t BPT_INTERNAL_CAPACITY = (BPT_PAGE_SIZE - BPT_NODE_HEADER) / BPT_INTERNAL_ENTRY;
+const size_t BPT_CACHE_PAGES = 64;
+const size_t BPT_JOURNAL_ENTRY = 4 + BPT_PAGE_SIZE; // page id, page
+const size_t BPT_JOURNAL_BUFFER = 1 << 20;
+const char BPT_MAGIC[4] = {'B', 'P', 'T', '1'};
+
+// Primary index kept as a paged B+-tree in its own file. A lookup reads only the pages
+// on one root-to-leaf path, an insert or delete dirties only the pages it changes, and
+// the leaves are chained so IDs can be walked in order. A small LRU cache holds hot pages
+// (the root and upper levels). Dirty pages only reach the file in flush(), at a checkpoint:
+// one pushed out of the cache is kept aside until then, so the file always holds the tree
+// of the last checkpoint, which the delta log replays onto. flush() writes its pages to a
+// journal first, so a crash halfway through is finished by open().
+// Deletes do not rebalance: underfull leaves are left in place and refilled by later inserts.
+class BPlusTree {
+public:
+    explicit BPlusTree(const string& filePath) : path(filePath) {}
+
+    // Changes not flushed by a checkpoint are dropped; the delta log holds them
+    ~BPlusTree() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
 
-    // Write the record to the file
-    file.write(newRecord.c_str(), newRecord.size());
-}
+    // Open the index file, creating an empty tree if it does not exist yet
+    bool open() {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        if (fd >= 0) {
+            return true;
+        }
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        replayJournal();
+        char header[BPT_PAGE_SIZE];
+        if (pread(fd, header, BPT_PAGE_SIZE, 0) == (ssize_t)BPT_PAGE_SIZE && memcmp(header, BPT_MAGIC, 4) == 0) {
+            memcpy(&root, header + 4, 4);
+            memcpy(&pageCount, header + 8, 4);
+            memcpy(&entryCount, header + 12, 8);
+            memcpy(&firstLeaf, header + 20, 4);
+            return true;
+        }
+        initialize();
+        flush();
+        return true;
+    }
 
+    bool find(string_view key, long& value) {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        if (!open() || key.size() > BPT_MAX_KEY) {
+            return false;
+        }
+        char* node = page(leafFor(key));
+        size_t index;
+        if (!leafSearch(node, key, index)) {
+            return false;
+        }
+        int64_t stored;
+        memcpy(&stored, leafEntry(node, index) + BPT_KEY_SIZE, sizeof(stored));
+        value = stored;
+        return true;
+    }
 
-// Helper function to read a delimited record
-string readDelimitedRecord(fstream &file) {
-    string line;
-    if (getline(file, line)) {
-        size_t pos = line.find('|');
-        if (pos != string::npos) {
-            // The part before the '|' is the length indicator
-            int length = stoi(line.substr(0, pos));
-            return line.substr(pos+1);
+    bool contains(string_view key) {
+        long value;
+        return find(key, value);
+    }
+
+    // Insert key or overwrite its value
+    void put(const string& key, long value) {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        if (!open() || key.size() > BPT_MAX_KEY) {
+            return;
+        }
+        string upKey;
+        uint32_t upPage = 0;
+        bool added = false;
+        if (insertInto(root, key, value, upKey, upPage, added)) {
+            // The root split: grow the tree by one level
+            uint32_t newRoot = allocatePage(false);
+            char* node = page(newRoot, true);
+            setFirstChild(node, root);
+            writeKey(internalEntry(node, 0), upKey);
+            memcpy(internalEntry(node, 0) + BPT_KEY_SIZE, &upPage, 4);
+            setCount(node, 1);
+            root = newRoot;
+            headerDirty = true;
+        }
+        if (added) {
+            entryCount++;
+            headerDirty = true;
         }
     }
-    return "";
-}
 
-// Load all indices at the start of the program
-void loadAllIndices() {
-    // Load Doctor Primary Index
-    ifstream file(DOC_PRIMARY_INDEX_FILE);
-    doctorPrimaryIndex.clear();
-    if (file) {
-        string id;
-        long position;
-        while (file >> id >> position) {
-            doctorPrimaryIndex[id] = position;
+    bool erase(const string& key) {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        if (!open() || key.size() > BPT_MAX_KEY) {
+            return false;
         }
-        file.close();
+        uint32_t leaf = leafFor(key);
+        char* node = page(leaf);
+        size_t index;
+        if (!leafSearch(node, key, index)) {
+            return false;
+        }
+        node = page(leaf, true);
+        size_t count = nodeCount(node);
+        memmove(leafEntry(node, index), leafEntry(node, index + 1), (count - index - 1) * BPT_LEAF_ENTRY);
+        setCount(node, count - 1);
+        entryCount--;
+        headerDirty = true;
+        return true;
     }
 
-    // Load Doctor Secondary Index
-    file.open(DOC_SECONDARY_INDEX_FILE);
-    doctorSecondaryIndex.clear();
-    if (file) {
-        string line;
-        while (getline(file, line)) {
-            istringstream iss(line);
-            string name, id;
-            iss >> name;
-            vector<string> ids;
-            while (iss >> id) {
-                ids.push_back(id);
-            }
-            doctorSecondaryIndex[name] = ids;
+    size_t size() {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        return open() ? entryCount : 0;
+    }
+
+    // Drop every entry and start over with an empty tree; the file follows at the next flush()
+    void clear() {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        if (!open()) {
+            return;
         }
-        file.close();
+        cache.clear();
+        cached.clear();
+        pinned.clear();
+        initialize();
     }
 
-    // Load Appointment Primary Index
-    file.open(APP_PRIMARY_INDEX_FILE);
-    appointmentPrimaryIndex.clear();
-    if (file) {
-        string id;
-        long position;
-        while (file >> id >> position) {
-            appointmentPrimaryIndex[id] = position;
+    // Write every dirty page and the header back to the file as one atomic step: the pages
+    // go to the journal, which is synced, then to their places in the file, which is synced,
+    // and the journal is removed. The file is cut back to pageCount pages.
+    void flush() {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        if (fd < 0) {
+            return;
         }
-        file.close();
+        vector<pair<uint32_t, const char*>> pages;
+        for (CachedPage& cachedPage : cache) {
+            if (cachedPage.dirty) {
+                pages.emplace_back(cachedPage.id, cachedPage.data.data());
+            }
+        }
+        for (const auto& kept : pinned) {
+            pages.emplace_back(kept.first, kept.second.data());
+        }
+        char header[BPT_PAGE_SIZE] = {};
+        if (headerDirty) {
+            memcpy(header, BPT_MAGIC, 4);
+            memcpy(header + 4, &root, 4);
+            memcpy(header + 8, &pageCount, 4);
+            memcpy(header + 12, &entryCount, 8);
+            memcpy(header + 20, &firstLeaf, 4);
+            pages.emplace_back(0, header);
+        }
+        if (pages.empty()) {
+            return;
+        }
+        if (!writeJournal(pages)) {
+            cerr << "Failed to write " << journalPath() << "; " << path << " is unchanged.\n";
+            return;
+        }
+        applyJournal(pages, pageCount);
+        for (CachedPage& cachedPage : cache) {
+            cachedPage.dirty = false;
+        }
+        pinned.clear();
+        headerDirty = false;
     }
 
-    // Load Appointment Secondary Index
-    file.open(APP_SECONDARY_INDEX_FILE);
-    appointmentSecondaryIndex.clear();
-    if (file) {
-        string line;
-        while (getline(file, line)) {
-            istringstream iss(line);
-            string key, appointmentId;
-            iss >> key;
-            vector<string> ids;
-            while (iss >> appointmentId) {
-                ids.push_back(appointmentId);
+    // Visit entries in key order starting at the first key >= from; stop when visit returns false
+    template <class Visit>
+    void forEachFrom(const string& from, Visit visit) {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        if (!open()) {
+            return;
+        }
+        uint32_t leaf = leafFor(from.substr(0, BPT_MAX_KEY));
+        size_t index;
+        leafSearch(page(leaf), from, index);
+        while (leaf != 0) {
+            char* node = page(leaf);
+            size_t count = nodeCount(node);
+            for (; index < count; index++) {
+                const char* entry = leafEntry(node, index);
+                int64_t stored;
+                memcpy(&stored, entry + BPT_KEY_SIZE, sizeof(stored));
+                if (!visit(readKey(entry), (long)stored)) {
+                    return;
+                }
             }
-            appointmentSecondaryIndex[key] = ids;
+            leaf = nextLeaf(node);
+            index = 0;
         }
-        file.close();
     }
 
-    // Load Availability List
-    loaddoc_availList();
-    loadApp_availList();
-}
+    // Load entries sorted by key, without duplicates. An empty tree is built bottom-up from
+    // full leaves, one page write each; a non-empty tree gets the entries inserted in order.
+    void bulkLoad(const vector<pair<string, long>>& entries) {
+        lock_guard<recursive_mutex> guard(cacheLock);
+        if (!open() || entries.empty()) {
+            return;
+        }
+        if (entryCount > 0) {
+            for (const auto& entry : entries) {
+                put(entry.first, entry.second);
+            }
+            return;
+        }
+        clear();
+        vector<pair<string, uint32_t>> level; // first key and page of each node on the level
+        for (size_t start = 0; start < entries.size(); start += BPT_LEAF_CAPACITY) {
+            size_t count = min(BPT_LEAF_CAPACITY, entries.size() - start);
+            uint32_t id = start == 0 ? firstLeaf : allocatePage(true);
+            if (!level.empty()) {
+                setNextLeaf(page(level.back().second, true), id);
+            }
+            char* node = page(id, true);
+            for (size_t i = 0; i < count; i++) {
+                int64_t stored = entries[start + i].second;
+                writeKey(leafEntry(node, i), entries[start + i].first);
+                memcpy(leafEntry(node, i) + BPT_KEY_SIZE, &stored, sizeof(stored));
+            }
+            setCount(node, count);
+            level.push_back({entries[start].first, id});
+        }
+        while (level.size() > 1) {
+            vector<pair<string, uint32_t>> parents;
+            for (size_t start = 0; start < level.size(); start += BPT_INTERNAL_CAPACITY + 1) {
+                size_t count = min(BPT_INTERNAL_CAPACITY + 1, level.size() - start);
+                uint32_t id = allocatePage(false);
+                char* node = page(id, true);
+                setFirstChild(node, level[start].second);
+                for (size_t i = 1; i < count; i++) {
+                    writeKey(internalEntry(node, i - 1), level[start + i].first);
+                    memcpy(internalEntry(node, i - 1) + BPT_KEY_SIZE, &level[start + i].second, 4);
+                }
+                setCount(node, count - 1);
+                parents.push_back({level[start].first, id});
+            }
+            level.swap(parents);
+        }
+        root = level[0].second;
+        entryCount = entries.size();
+        headerDirty = true;
+    }
 
-// Save all indices at the end of the program
-void saveAllIndices() {
-    // Save Doctor Primary Index
-    ofstream file(DOC_PRIMARY_INDEX_FILE);
-    for (const auto& entry : doctorPrimaryIndex) {
-        file << entry.first << " " << entry.second << "\n";
+    // Visit every entry in key order
+    template <class Visit>
+    void forEach(Visit visit) {
+        forEachFrom("", [&](string_view key, long value) {
+            visit(key, value);
+            return true;
+        });
     }
-    file.close();
 
-    // Save Doctor Secondary Index
-    file.open(DOC_SECONDARY_INDEX_FILE);
-    for (const auto& entry : doctorSecondaryIndex) {
-        file << entry.first;
-        for (const auto& id : entry.second) {
-            file << " " << id;
-        }
-        file << "\n";
+private:
+    struct CachedPage {
+        uint32_t id;
+        bool dirty;
+        vector<char> data;
+    };
+
+    string path;
+    recursive_mutex cacheLock; // held for every public call, so concurrent readers can share the tree
+    int fd = -1;
+    uint32_t root = 1;
+    uint32_t pageCount = 2;
+    uint64_t entryCount = 0;
+    uint32_t firstLeaf = 1;
+    bool headerDirty = false;
+    list<CachedPage> cache; // most recently used first
+    unordered_map<uint32_t, list<CachedPage>::iterator> cached;
+    unordered_map<uint32_t, vector<char>> pinned; // dirty pages pushed out of the cache, until flush()
+
+    void initialize() {
+        root = 1;
+        firstLeaf = 1;
+        pageCount = 2;
+        entryCount = 0;
+        headerDirty = true;
+        char* node = newPage(1);
+        node[0] = 1;
     }
-    file.close();
 
-    // Save Appointment Primary Index
-    file.open(APP_PRIMARY_INDEX_FILE);
-    for (const auto& entry : appointmentPrimaryIndex) {
-        file << entry.first << " " << entry.second << "\n";
+    string journalPath() const {
+        return path + ".journal";
     }
-    file.close();
 
-    // Save Appointment Secondary Index
-    file.open(APP_SECONDARY_INDEX_FILE);
-    for (const auto& entry : appointmentSecondaryIndex) {
-        file << entry.first;
-        for (const auto& id : entry.second) {
-            file << " " << id;
+    // Write and sync the journal of one flush(): page id and contents of every page, then
+    // the page count and the checksum of all that, through a buffer of BPT_JOURNAL_BUFFER bytes
+    bool writeJournal(const vector<pair<uint32_t, const char*>>& pages) {
+        int journalFd = ::open(journalPath().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (journalFd < 0) {
+            return false;
         }
-        file << "\n";
+        string buffer;
+        uint64_t hash = checksum(nullptr, 0);
+        bool written = true;
+        auto append = [&](const char* data, size_t size, bool last) {
+            buffer.append(data, size);
+            if (written && (last || buffer.size() >= BPT_JOURNAL_BUFFER)) {
+                written = ::write(journalFd, buffer.data(), buffer.size()) == (ssize_t)buffer.size();
+                buffer.clear();
+            }
+        };
+        for (const auto& page : pages) {
+            hash = checksum(reinterpret_cast<const char*>(&page.first), 4, hash);
+            hash = checksum(page.second, BPT_PAGE_SIZE, hash);
+            append(reinterpret_cast<const char*>(&page.first), 4, false);
+            append(page.second, BPT_PAGE_SIZE, false);
+        }
+        uint64_t trailer[2] = {pages.size(), hash};
+        append(reinterpret_cast<const char*>(trailer), sizeof(trailer), true);
+        written = written && fsync(journalFd) == 0;
+        ::close(journalFd);
+        return written;
     }
-    file.close();
 
-    // Save Availability List
-    savedoc_availList();
-    saveApp_availList();
-}
+    // Write the journaled pages in place, cut the file to pageTotal pages (if not 0), sync it
+    // and drop the journal
+    void applyJournal(const vector<pair<uint32_t, const char*>>& pages, uint32_t pageTotal) {
+        for (const auto& page : pages) {
+            if (pwrite(fd, page.second, BPT_PAGE_SIZE, (off_t)page.first * BPT_PAGE_SIZE) != (ssize_t)BPT_PAGE_SIZE) {
+                cerr << "Failed to write " << path << ".\n";
+                return; // the journal stays for the next open()
+            }
+        }
+        if ((pageTotal > 0 && ftruncate(fd, (off_t)pageTotal * BPT_PAGE_SIZE) != 0) || fsync(fd) != 0) {
+            cerr << "Failed to sync " << path << ".\n";
+            return;
+        }
+        unlink(journalPath().c_str());
+    }
 
-// Load and save availability list
-void loaddoc_availList() {
-    ifstream file(DOC_AVAIL_LIST_FILE);
-    doc_availList.clear();
-    if (file) {
-        long position;
-        size_t size;
-        while (file >> position >> size) {
-            doc_availList[position] = size;
+    // Finish a flush() interrupted after its journal was synced. A journal that is torn or
+    // fails its checksum was never applied and is dropped.
+    void replayJournal() {
+        ifstream file(journalPath(), ios::binary);
+        if (!file) {
+            return;
         }
-        file.close();
+        string journal((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        uint64_t trailer[2] = {0, 0};
+        if (journal.size() >= sizeof(trailer)) {
+            memcpy(trailer, journal.data() + journal.size() - sizeof(trailer), sizeof(trailer));
+            journal.resize(journal.size() - sizeof(trailer));
+        }
+        if (trailer[0] == 0 || journal.size() != trailer[0] * BPT_JOURNAL_ENTRY ||
+            checksum(journal.data(), journal.size()) != trailer[1]) {
+            unlink(journalPath().c_str());
+            return;
+        }
+        // The page count only changes with the header, which is then in the journal
+        vector<pair<uint32_t, const char*>> pages;
+        uint32_t pageTotal = 0;
+        for (size_t i = 0; i < trailer[0]; i++) {
+            const char* entry = journal.data() + i * BPT_JOURNAL_ENTRY;
+            uint32_t id;
+            memcpy(&id, entry, 4);
+            if (id == 0) {
+                memcpy(&pageTotal, entry + 4 + 8, 4);
+            }
+            pages.emplace_back(id, entry + 4);
+        }
+        applyJournal(pages, pageTotal);
     }
-}
 
-// Load and save availability list
-void loadApp_availList() {
-    ifstream file(APP_AVAIL_LIST_FILE);
-    app_availList.clear();
-    if (file) {
-        long position;
-        size_t size;
-        while (file >> position >> size) {
-            app_availList[position] = size;
+    // Make room for one more page in the cache; a dirty page is kept aside until flush()
+    void evict() {
+        while (cache.size() >= BPT_CACHE_PAGES) {
+            CachedPage& victim = cache.back();
+            if (victim.dirty) {
+                pinned[victim.id] = std::move(victim.data);
+            }
+            cached.erase(victim.id);
+            cache.pop_back();
         }
-        file.close();
     }
-}
 
-void savedoc_availList() {
-    ofstream file(DOC_AVAIL_LIST_FILE);
-    for (const auto& entry : doc_availList) {
-        file << entry.first << " " << entry.second << "\n";
+    // Cached page contents; pointers stay valid for the duration of one tree operation
+    char* page(uint32_t id, bool forWrite = false) {
+        auto hit = cached.find(id);
+        if (hit != cached.end()) {
+            cache.splice(cache.begin(), cache, hit->second);
+        } else {
+            evict();
+            cache.push_front(CachedPage{id, false, {}});
+            auto kept = pinned.find(id);
+            if (kept != pinned.end()) {
+                cache.front().data = std::move(kept->second);
+                cache.front().dirty = true;
+                pinned.erase(kept);
+            } else {
+                cache.front().data.assign(BPT_PAGE_SIZE, 0);
+                if (pread(fd, cache.front().data.data(), BPT_PAGE_SIZE, (off_t)id * BPT_PAGE_SIZE) < 0) {
+                    cerr << "Failed to read " << path << ".\n";
+                }
+            }
+            cached[id] = cache.begin();
+        }
+        cache.front().dirty |= forWrite;
+        return cache.front().data.data();
     }
-    file.close();
-}
 
-void saveApp_availList() {
-    ofstream file(APP_AVAIL_LIST_FILE);
-    for (const auto& entry : app_availList) {
-        file << entry.first << " " << entry.second << "\n";
+    // Zeroed, dirty page for a freshly allocated page id
+    char* newPage(uint32_t id) {
+        evict();
+        pinned.erase(id);
+        cache.push_front(CachedPage{id, true, vector<char>(BPT_PAGE_SIZE, 0)});
+        cached[id] = cache.begin();
+        return cache.front().data.data();
     }
-    file.close();
-}
 
+    uint32_t allocatePage(bool leaf) {
+        uint32_t id = pageCount++;
+        headerDirty = true;
+        newPage(id)[0] = leaf ? 1 : 0;
+        return id;
+    }
 
-// Add a doctor to the database
-void addDoctor() {
-    Doctor doctor;
-    cout << "Enter Doctor ID: ";
-    cin >> doctor.id;
-    cout << "Enter Name: ";
-    cin.ignore();
-    getline(cin, doctor.name);
-    cout << "Enter Address: ";
-    getline(cin, doctor.address);
+    static bool isLeaf(const char* node) { return node[0] == 1; }
 
-    if (doctorPrimaryIndex.find(doctor.id) != doctorPrimaryIndex.end()) {
-        cout << "Doctor ID already exists.\n";
-        return;
+    static size_t nodeCount(const char* node) {
+        uint16_t count;
+        memcpy(&count, node + 2, 2);
+        return count;
     }
 
-    fstream file(DOCTOR_FILE, ios::in | ios::out);
-    if (!file) {
-        cerr << "Failed to open doctor file.\n";
-        return;
+    static void setCount(char* node, size_t count) {
+        uint16_t value = count;
+        memcpy(node + 2, &value, 2);
     }
-    string doctorRecord = doctor.id + "|" + doctor.name + "|" + doctor.address + "|";
-    for(auto it = doc_availList.begin(); it != doc_availList.end(); ++it) {
-        if(it->second >= doctorRecord.size()) {
-            file.seekp(it->first);
-            cout<<"Avail List entered "<<file.tellp()<<endl;
-            string str = to_string(it->second);
-            writeDelimitedRecord(file, doctorRecord, it->second+str.size()+1);
-            doctorPrimaryIndex[doctor.id] = it->first;
-            doctorSecondaryIndex[doctor.name].push_back(doctor.id);
-            doc_availList.erase(it);
-            return;
-        }
+
+    static uint32_t nextLeaf(const char* node) {
+        uint32_t next;
+        memcpy(&next, node + 4, 4);
+        return next;
     }
 
-    file.seekp(0, ios::end);
-    long position = file.tellp();
-    doctorPrimaryIndex[doctor.id] = position;
+    static void setNextLeaf(char* node, uint32_t next) { memcpy(node + 4, &next, 4); }
+    static uint32_t firstChild(const char* node) { return nextLeaf(node); }
+    static void setFirstChild(char* node, uint32_t child) { setNextLeaf(node, child); }
 
-    // Add to secondary index
-    doctorSecondaryIndex[doctor.name].push_back(doctor.id);
+    static char* leafEntry(char* node, size_t index) { return node + BPT_NODE_HEADER + index * BPT_LEAF_ENTRY; }
+    static char* internalEntry(char* node, size_t index) { return node + BPT_NODE_HEADER + index * BPT_INTERNAL_ENTRY; }
 
-    // Write to file (Delimited format without newline)
-    writeDelimitedRecord(file, doctorRecord, doctorRecord.size());
-    file.close();
-    cout << "Doctor added successfully.\n";
-}
+    static string_view readKey(const char* entry) {
+        return string_view(entry + 1, (unsigned char)entry[0]);
+    }
 
-void addAppointment() {
-    Appointment appointment;
-    cout << "Enter Appointment ID: ";
-    cin >> appointment.id;
-    cout << "Enter Doctor ID: ";
-    cin >> appointment.doctorId;
-    cout << "Enter Appointment Date: ";
-    cin.ignore();
-    getline(cin, appointment.date);
+    static void writeKey(char* entry, string_view key) {
+        memset(entry, 0, BPT_KEY_SIZE);
+        entry[0] = (char)key.size();
+        memcpy(entry + 1, key.data(), key.size());
+    }
 
-    cout<<appointment.id<<endl;
-    // Check if the appointment ID already exists
-    if (appointmentPrimaryIndex.find(appointment.id) != appointmentPrimaryIndex.end()) {
-        cout << "Appointment ID already exists.\n";
-        return;
+    static uint32_t childAt(char* node, size_t index) {
+        if (index == 0) {
+            return firstChild(node);
+        }
+        uint32_t child;
+        memcpy(&child, internalEntry(node, index - 1) + BPT_KEY_SIZE, 4);
+        return child;
     }
 
-    // Validate if the Doctor ID exists
-    if (doctorPrimaryIndex.find(appointment.doctorId) == doctorPrimaryIndex.end()) {
-        cout << "Doctor ID does not exist. Cannot create appointment.\n";
-        return;
+    // Index of the child subtree that may contain key
+    static size_t childIndex(char* node, string_view key) {
+        size_t low = 0, high = nodeCount(node);
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (key < readKey(internalEntry(node, mid))) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+        return low;
     }
 
-    // Open the appointment file
-    fstream file(APP_FILE, ios::in | ios::out | ios::app);
-    if (!file) {
-        cerr << "Failed to open appointment file.\n";
-        return;
+    // Position of key in the leaf, or of the first larger key when it is absent
+    static bool leafSearch(char* node, string_view key, size_t& index) {
+        size_t low = 0, high = nodeCount(node);
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (readKey(leafEntry(node, mid)) < key) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        index = low;
+        return low < nodeCount(node) && readKey(leafEntry(node, low)) == key;
     }
 
-    file.seekp(0, ios::end); // Move to the end of the file
-    long position = file.tellp(); // Record the current position
-    appointmentPrimaryIndex[appointment.id] = position; // Update the primary index
+    uint32_t leafFor(string_view key) {
+        uint32_t id = root;
+        char* node = page(id);
+        while (!isLeaf(node)) {
+            id = childAt(node, childIndex(node, key));
+            node = page(id);
+        }
+        return id;
+    }
 
-    // Add to the secondary index
-    appointmentSecondaryIndex[appointment.doctorId].push_back(appointment.id);
+    // Insert into the subtree at pageId. Returns true when the node split, with the
+    // separator key and new right sibling to be inserted into the parent.
+    bool insertInto(uint32_t pageId, const string& key, long value, string& upKey, uint32_t& upPage, bool& added) {
+        char* node = page(pageId);
+        if (isLeaf(node)) {
+            size_t index;
+            int64_t stored = value;
+            if (leafSearch(node, key, index)) {
+                memcpy(leafEntry(page(pageId, true), index) + BPT_KEY_SIZE, &stored, sizeof(stored));
+                return false;
+            }
+            added = true;
+            node = page(pageId, true);
+            size_t count = nodeCount(node);
+            if (count < BPT_LEAF_CAPACITY) {
+                memmove(leafEntry(node, index + 1), leafEntry(node, index), (count - index) * BPT_LEAF_ENTRY);
+                writeKey(leafEntry(node, index), key);
+                memcpy(leafEntry(node, index) + BPT_KEY_SIZE, &stored, sizeof(stored));
+                setCount(node, count + 1);
+                return false;
+            }
 
-    // Write to file (Delimited format with length prefix)
-    string appointmentRecord = appointment.id + "|" + appointment.date + "|" + appointment.doctorId + "|";
-    writeDelimitedRecord(file, appointmentRecord, appointmentRecord.size());
-    file.close();
+            // Split the full leaf: gather all entries plus the new one, then divide them
+            vector<char> entries((count + 1) * BPT_LEAF_ENTRY);
+            memcpy(entries.data(), leafEntry(node, 0), index * BPT_LEAF_ENTRY);
+            writeKey(&entries[index * BPT_LEAF_ENTRY], key);
+            memcpy(&entries[index * BPT_LEAF_ENTRY + BPT_KEY_SIZE], &stored, sizeof(stored));
+            memcpy(&entries[(index + 1) * BPT_LEAF_ENTRY], leafEntry(node, index), (count - index) * BPT_LEAF_ENTRY);
+
+            size_t leftCount = (count + 1) / 2;
+            size_t rightCount = count + 1 - leftCount;
+            uint32_t rightId = allocatePage(true);
+            char* right = page(rightId, true);
+            node = page(pageId, true);
+            memcpy(leafEntry(node, 0), entries.data(), leftCount * BPT_LEAF_ENTRY);
+            setCount(node, leftCount);
+            memcpy(leafEntry(right, 0), &entries[leftCount * BPT_LEAF_ENTRY], rightCount * BPT_LEAF_ENTRY);
+            setCount(right, rightCount);
+            setNextLeaf(right, nextLeaf(node));
+            setNextLeaf(node, rightId);
+
+            upKey = string(readKey(leafEntry(right, 0)));
+            upPage = rightId;
+            return true;
+        }
 
-    cout << "Appointment added successfully.\n";
-}
+        size_t index = childIndex(node, key);
+        string childKey;
+        uint32_t childPage;
+        if (!insertInto(childAt(node, index), key, value, childKey, childPage, added)) {
+            return false;
+        }
 
-int binarySearch(const map<long, size_t>& index, int id) {
-    long start = 0;
-    long end = index.size() - 1;
-    while (start <= end) {
-        long mid = start + (end - start) / 2;
-        if (id == mid) {
-            return index.at(mid);
+        // A child split: add its separator after child index
+        node = page(pageId, true);
+        size_t count = nodeCount(node);
+        if (count < BPT_INTERNAL_CAPACITY) {
+            memmove(internalEntry(node, index + 1), internalEntry(node, index), (count - index) * BPT_INTERNAL_ENTRY);
+            writeKey(internalEntry(node, index), childKey);
+            memcpy(internalEntry(node, index) + BPT_KEY_SIZE, &childPage, 4);
+            setCount(node, count + 1);
+            return false;
         }
-        else if (id > mid) {
-            start = mid + 1;
+
+        // Split the full internal node; the middle separator moves up to the parent
+        vector<char> entries((count + 1) * BPT_INTERNAL_ENTRY);
+        memcpy(entries.data(), internalEntry(node, 0), index * BPT_INTERNAL_ENTRY);
+        writeKey(&entries[index * BPT_INTERNAL_ENTRY], childKey);
+        memcpy(&entries[index * BPT_INTERNAL_ENTRY + BPT_KEY_SIZE], &childPage, 4);
+        memcpy(&entries[(index + 1) * BPT_INTERNAL_ENTRY], internalEntry(node, index), (count - index) * BPT_INTERNAL_ENTRY);
+
+        size_t leftCount = (count + 1) / 2;
+        const char* middle = &entries[leftCount * BPT_INTERNAL_ENTRY];
+        uint32_t middleChild;
+        memcpy(&middleChild, middle + BPT_KEY_SIZE, 4);
+        size_t rightCount = count - leftCount;
+
+        uint32_t rightId = allocatePage(false);
+        char* right = page(rightId, true);
+        node = page(pageId, true);
+        memcpy(internalEntry(node, 0), entries.data(), leftCount * BPT_INTERNAL_ENTRY);
+        setCount(node, leftCount);
+        setFirstChild(right, middleChild);
+        memcpy(internalEntry(right, 0), middle + BPT_INTERNAL_ENTRY, rightCount * BPT_INTERNAL_ENTRY);
+        setCount(right, rightCount);
+
+        upKey = string(readKey(middle));
+        upPage = rightId;
+        return true;
+    }
+};
+
+// Read-only view of a sorted key -> ID list table inside a mapped snapshot section:
+//   uint64 keyCount, uint64 idCount,
+//   uint64 keyOffsets[keyCount + 1], uint64 postingStarts[keyCount + 1], uint64 idOffsets[idCount + 1],
+//   key bytes, ID bytes
+// Lookups binary-search the key offsets directly in the mapping; nothing is decoded up front.
+struct PostingTableView {
+    size_t keyCount = 0;
+    const uint64_t* keyOffsets = nullptr;
+    const uint64_t* postingStarts = nullptr;
+    const uint64_t* idOffsets = nullptr;
+    const char* keyBytes = nullptr;
+    const char* idBytes = nullptr;
+
+    // Point the view at a section; false if the section is too small for its own counts
+    bool attach(const char* data, size_t size) {
+        *this = PostingTableView();
+        if (size < 16) {
+            return false;
         }
-        else {
-            end = mid - 1;
+        uint64_t keys, ids;
+        memcpy(&keys, data, 8);
+        memcpy(&ids, data + 8, 8);
+        size_t tables = 16 + 8 * ((keys + 1) * 2 + ids + 1);
+        if (tables > size) {
+            return false;
+        }
+        const uint64_t* words = reinterpret_cast<const uint64_t*>(data + 16);
+        keyOffsets = words;
+        postingStarts = words + keys + 1;
+        idOffsets = postingStarts + keys + 1;
+        keyBytes = data + tables;
+        idBytes = keyBytes + keyOffsets[keys];
+        if (tables + keyOffsets[keys] + idOffsets[ids] > size || postingStarts[keys] != ids) {
+            return false;
         }
+        keyCount = keys;
+        return true;
     }
-    return -1;
-}
 
+    string_view key(size_t slot) const {
+        return string_view(keyBytes + keyOffsets[slot], keyOffsets[slot + 1] - keyOffsets[slot]);
+    }
 
-// Search for a doctor by ID
-void searchDoctorByID(const string& doctorId) {
+    size_t postingCount(size_t slot) const {
+        return postingStarts[slot + 1] - postingStarts[slot];
+    }
 
+    string_view id(size_t slot, size_t i) const {
+        size_t n = postingStarts[slot] + i;
+        return string_view(idBytes + idOffsets[n], idOffsets[n + 1] - idOffsets[n]);
+    }
 
-    fstream file(DOCTOR_FILE);
-    if (!file) {
-        cerr << "Failed to open doctor file.\n";
-        return;
+    bool find(string_view wanted, size_t& slot) const {
+        size_t low = 0, high = keyCount;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (key(mid) < wanted) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        slot = low;
+        return low < keyCount && key(low) == wanted;
     }
+};
 
-    if (doctorPrimaryIndex.find(doctorId) == doctorPrimaryIndex.end()) {
-        cout << "Doctor not found.\n";
-        return;
+// Builds the byte layout read by PostingTableView from keys given in sorted order
+struct PostingTableWriter {
+    vector<uint64_t> keyOffsets{0};
+    vector<uint64_t> postingStarts{0};
+    vector<uint64_t> idOffsets{0};
+    string keyBytes;
+    string idBytes;
+
+    void addKey(string_view key) {
+        keyBytes.append(key.data(), key.size());
+        keyOffsets.push_back(keyBytes.size());
+        postingStarts.push_back(postingStarts.back());
     }
 
-    long position = doctorPrimaryIndex[doctorId];
-    file.seekg(position);
+    // Append an ID to the posting list of the most recently added key
+    void addId(string_view id) {
+        idBytes.append(id.data(), id.size());
+        idOffsets.push_back(idBytes.size());
+        postingStarts.back()++;
+    }
 
-    string doctorRecord = readDelimitedRecord(file);
-    if (!doctorRecord.empty()) {
-        istringstream iss(doctorRecord);
-        string id, name, address;
-        getline(iss, id, '|');
-        getline(iss, name, '|');
-        getline(iss, address, '|');
+    string finish() const {
+        uint64_t counts[2] = {keyOffsets.size() - 1, idOffsets.size() - 1};
+        string out(reinterpret_cast<const char*>(counts), sizeof(counts));
+        out.append(reinterpret_cast<const char*>(keyOffsets.data()), keyOffsets.size() * 8);
+        out.append(reinterpret_cast<const char*>(postingStarts.data()), postingStarts.size() * 8);
+        out.append(reinterpret_cast<const char*>(idOffsets.data()), idOffsets.size() * 8);
+        out += keyBytes;
+        out += idBytes;
+        return out;
+    }
+};
 
-        cout << "Doctor ID: " << id << "\n"
-             << "Name: " << name << "\n"
-             << "Address: " << address << endl;
+// Compressed posting list of sorted record offsets (also its layout inside the snapshot):
+//   uint64 total, uint32 blockCount, uint32 reserved,
+//   blockCount x {uint64 first, uint32 count, uint32 end}     skip pointers, one per block
+//   varint deltas: block b holds count - 1 deltas after `first`, ending at byte `end`
+// Blocks hold at most POSTING_BLOCK_SIZE offsets, so a lookup binary-searches the skip
+// pointers and decodes a single block.
+const size_t POSTING_BLOCK_SIZE = 128;
+const size_t POSTING_HEADER = 16;
+const size_t POSTING_SKIP_ENTRY = 16;
+
+void appendVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(char((value & 0x7f) | 0x80));
+        value >>= 7;
     }
+    out.push_back(char(value));
+}
 
-    file.close();
+const char* readVarint(const char* p, uint64_t& value) {
+    value = 0;
+    for (int shift = 0;; shift += 7) {
+        unsigned char byte = *p++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return p;
+        }
+    }
 }
 
-// Search for doctors by name
-void searchDoctorByName(const string& name) {
+// Read-only access to an encoded posting list, whether owned or inside the mapped snapshot
+struct PostingListView {
+    string_view data;
 
-    if (doctorSecondaryIndex.find(name) == doctorSecondaryIndex.end()) {
-        cout << "No doctors found with the name: " << name << endl;
-        return;
+    size_t size() const {
+        uint64_t total = 0;
+        if (data.size() >= POSTING_HEADER) {
+            memcpy(&total, data.data(), 8);
+        }
+        return total;
     }
 
-    cout << "Doctors with the name " << name << ":\n";
-    for (const string& doctorId : doctorSecondaryIndex[name]) {
-        searchDoctorByID(doctorId);
+    size_t blockCount() const {
+        uint32_t count = 0;
+        if (data.size() >= POSTING_HEADER) {
+            memcpy(&count, data.data() + 8, 4);
+        }
+        return count;
     }
-}
+
+    uint64_t blockFirst(size_t block) const {
+        uint64_t first;
+        memcpy(&first, data.data() + POSTING_HEADER + block * POSTING_SKIP_ENTRY, 8);
+        return first;
+    }
+
+    size_t blockLength(size_t block) const {
+        uint32_t count;
+        memcpy(&count, data.data() + POSTING_HEADER + block * POSTING_SKIP_ENTRY + 8, 4);
+        return count;
+    }
+
+    size_t blockEnd(size_t block) const {
+        uint32_t end;
+        memcpy(&end, data.data() + POSTING_HEADER + block * POSTING_SKIP_ENTRY + 12, 4);
+        return end;
+    }
+
+    size_t blockStart(size_t block) const {
+        return block == 0 ? 0 : blockEnd(block - 1);
+    }
+
+    const char* deltas() const {
+        return data.data() + POSTING_HEADER + blockCount() * POSTING_SKIP_ENTRY;
+    }
+
+    void decodeBlock(size_t block, vector<uint64_t>& values) const {
+        values.clear();
+        uint64_t value = blockFirst(block);
+        values.push_back(value);
+        const char* p = deltas() + blockStart(block);
+        for (size_t i = 1; i < blockLength(block); i++) {
+            uint64_t delta;
+            p = readVarint(p, delta);
+            value += delta;
+            values.push_back(value);
+        }
+    }
+
+    // Last block whose first offset is <= value (block 0 when value precedes every block)
+    size_t findBlock(uint64_t value, size_t from = 0) const {
+        size_t low = from, high = blockCount();
+        while (high - low > 1) {
+            size_t mid = (low + high) / 2;
+            if (blockFirst(mid) <= value) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    bool contains(uint64_t value) const {
+        if (blockCount() == 0) {
+            return false;
+        }
+        vector<uint64_t> values;
+        decodeBlock(findBlock(value), values);
+        return binary_search(values.begin(), values.end(), value);
+    }
+
+    template <class Visit>
+    void forEach(Visit visit) const {
+        vector<uint64_t> values;
+        for (size_t block = 0; block < blockCount(); block++) {
+            decodeBlock(block, values);
+            for (uint64_t value : values) {
+                visit(value);
+            }
+        }
+    }
+};
+
+// Forward cursor over a posting list; seek() uses the skip pointers to jump whole blocks
+struct PostingCursor {
+    PostingListView list;
+    size_t block = 0;
+    size_t index = 0;
+    vector<uint64_t> values;
+
+    explicit PostingCursor(PostingListView view) : list(view) {
+        if (list.blockCount() > 0) {
+            list.decodeBlock(0, values);
+        }
+    }
+
+    bool valid() const { return index < values.size(); }
+    uint64_t value() const { return values[index]; }
+
+    void next() {
+        if (++index == values.size() && block + 1 < list.blockCount()) {
+            list.decodeBlock(++block, values);
+            index = 0;
+        }
+    }
+
+    // Advance to the first offset >= target
+    void seek(uint64_t target) {
+        if (!valid() || value() >= target) {
+            return;
+        }
+        size_t targetBlock = list.findBlock(target, block);
+        if (targetBlock != block) {
+            block = targetBlock;
+            list.decodeBlock(block, values);
+            index = 0;
+        }
+        index = lower_bound(values.begin() + index, values.end(), target) - values.begin();
+        if (index == values.size() && block + 1 < list.blockCount()) {
+            list.decodeBlock(++block, values);
+            index = 0;
+        }
+    }
+};
+
+// Visit offsets present in both lists, leapfrogging through the skip pointers
+template <class Visit>
+void intersectPostings(PostingListView a, PostingListView b, Visit visit) {
+    PostingCursor left(a), right(b);
+    while (left.valid() && right.valid()) {
+        if (left.value() < right.value()) {
+            left.seek(right.value());
+        } else if (right.value() < left.value()) {
+            right.seek(left.value());
+        } else {
+            visit(left.value());
+            left.next();
+            right.next();
+        }
+    }
+}
+
+// Visit offsets present in either list, in order and without duplicates
+template <class Visit>
+void unitePostings(PostingListView a, PostingListView b, Visit visit) {
+    PostingCursor left(a), right(b);
+    while (left.valid() || right.valid()) {
+        if (!right.valid() || (left.valid() && left.value() < right.value())) {
+            visit(left.value());
+            left.next();
+        } else if (!left.valid() || right.value() < left.value()) {
+            visit(right.value());
+            right.next();
+        } else {
+            visit(left.value());
+            left.next();
+            right.next();
+        }
+    }
+}
+
+// Offsets listed in every one (unite false) or any one (unite true) of the lists, ascending.
+// The first two lists are merged cursor against cursor and each further list against the
+// result so far; an intersection takes the shortest lists first, so seeks skip the most.
+vector<uint64_t> mergePostings(vector<PostingListView> lists, bool unite) {
+    vector<uint64_t> merged;
+    auto collect = [&](uint64_t offset) { merged.push_back(offset); };
+    if (!unite) {
+        sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.size() < b.size(); });
+    }
+    if (lists.size() == 1) {
+        lists[0].forEach(collect);
+    } else if (lists.size() > 1) {
+        if (unite) {
+            unitePostings(lists[0], lists[1], collect);
+        } else {
+            intersectPostings(lists[0], lists[1], collect);
+        }
+    }
+    for (size_t i = 2; i < lists.size(); i++) {
+        vector<uint64_t> previous;
+        previous.swap(merged);
+        PostingCursor cursor(lists[i]);
+        for (uint64_t offset : previous) {
+            if (unite) {
+                for (; cursor.valid() && cursor.value() <= offset; cursor.next()) {
+                    if (cursor.value() < offset) {
+                        merged.push_back(cursor.value());
+                    }
+                }
+                merged.push_back(offset);
+            } else {
+                cursor.seek(offset);
+                if (cursor.valid() && cursor.value() == offset) {
+                    merged.push_back(offset);
+                }
+            }
+        }
+        for (; unite && cursor.valid(); cursor.next()) {
+            merged.push_back(cursor.value());
+        }
+    }
+    return merged;
+}
+
+// Owned, mutable posting list. Appending past the last offset (the usual case, since new
+// records go to the end of the file) only extends the last block; other changes re-encode
+// the one block they touch.
+class PostingList {
+public:
+    PostingList() = default;
+    explicit PostingList(string_view encoded) : data(encoded) {}
+
+    PostingListView view() const { return PostingListView{data}; }
+    size_t size() const { return view().size(); }
+    bool empty() const { return size() == 0; }
+    const string& bytes() const { return data; }
+
+    static PostingList fromSorted(const vector<uint64_t>& values) {
+        vector<vector<uint64_t>> blocks;
+        for (size_t i = 0; i < values.size(); i += POSTING_BLOCK_SIZE) {
+            blocks.emplace_back(values.begin() + i, values.begin() + min(values.size(), i + POSTING_BLOCK_SIZE));
+        }
+        PostingList list;
+        list.replaceBlocks(0, 0, blocks);
+        return list;
+    }
+
+    void insert(uint64_t value) {
+        PostingListView list = view();
+        size_t blocks = list.blockCount();
+        if (blocks == 0) {
+            replaceBlocks(0, 0, {{value}});
+            return;
+        }
+        size_t block = list.findBlock(value);
+        vector<uint64_t> values;
+        list.decodeBlock(block, values);
+        if (binary_search(values.begin(), values.end(), value)) {
+            return;
+        }
+        if (block == blocks - 1 && value > values.back() && values.size() < POSTING_BLOCK_SIZE) {
+            // Fast path: one more delta at the very end of the buffer (read the total first,
+            // the append may move the buffer the view points into)
+            uint64_t total = list.size();
+            appendVarint(data, value - values.back());
+            setBlockLength(block, values.size() + 1, data.size() - (POSTING_HEADER + blocks * POSTING_SKIP_ENTRY));
+            setTotal(total + 1);
+            return;
+        }
+        values.insert(upper_bound(values.begin(), values.end(), value), value);
+        if (values.size() > POSTING_BLOCK_SIZE) {
+            size_t half = values.size() / 2;
+            replaceBlocks(block, 1, {vector<uint64_t>(values.begin(), values.begin() + half),
+                                     vector<uint64_t>(values.begin() + half, values.end())});
+        } else {
+            replaceBlocks(block, 1, {values});
+        }
+    }
+
+    // Add sorted values; when they all come after the current last value only the last
+    // block is re-encoded
+    void appendSorted(const vector<uint64_t>& values) {
+        if (values.empty()) {
+            return;
+        }
+        PostingListView list = view();
+        size_t blocks = list.blockCount();
+        vector<uint64_t> tail;
+        if (blocks > 0) {
+            list.decodeBlock(blocks - 1, tail);
+        }
+        if (!tail.empty() && values.front() <= tail.back()) {
+            for (uint64_t value : values) {
+                insert(value);
+            }
+            return;
+        }
+        tail.insert(tail.end(), values.begin(), values.end());
+        vector<vector<uint64_t>> chunks;
+        for (size_t i = 0; i < tail.size(); i += POSTING_BLOCK_SIZE) {
+            chunks.emplace_back(tail.begin() + i, tail.begin() + min(tail.size(), i + POSTING_BLOCK_SIZE));
+        }
+        replaceBlocks(blocks > 0 ? blocks - 1 : 0, blocks > 0 ? 1 : 0, chunks);
+    }
+
+    bool erase(uint64_t value) {
+        PostingListView list = view();
+        if (list.blockCount() == 0) {
+            return false;
+        }
+        size_t block = list.findBlock(value);
+        vector<uint64_t> values;
+        list.decodeBlock(block, values);
+        auto it = lower_bound(values.begin(), values.end(), value);
+        if (it == values.end() || *it != value) {
+            return false;
+        }
+        values.erase(it);
+        if (values.empty()) {
+            replaceBlocks(block, 1, {});
+        } else {
+            replaceBlocks(block, 1, {values});
+        }
+        return true;
+    }
+
+private:
+    string data;
+
+    void setTotal(uint64_t total) { memcpy(&data[0], &total, 8); }
+
+    void setBlockLength(size_t block, uint32_t count, uint32_t end) {
+        memcpy(&data[POSTING_HEADER + block * POSTING_SKIP_ENTRY + 8], &count, 4);
+        memcpy(&data[POSTING_HEADER + block * POSTING_SKIP_ENTRY + 12], &end, 4);
+    }
+
+    // Replace `count` blocks starting at `first` with freshly encoded ones, copying the
+    // encoded bytes of every other block unchanged
+    void replaceBlocks(size_t first, size_t count, const vector<vector<uint64_t>>& replacement) {
+        PostingListView old = view();
+        size_t oldBlocks = old.blockCount();
+        vector<uint64_t> firsts;
+        vector<uint32_t> lengths;
+        string deltas;
+        vector<uint32_t> ends;
+        uint64_t total = 0;
+
+        auto copyBlock = [&](size_t block) {
+            firsts.push_back(old.blockFirst(block));
+            lengths.push_back(old.blockLength(block));
+            deltas.append(old.deltas() + old.blockStart(block), old.blockEnd(block) - old.blockStart(block));
+            ends.push_back(deltas.size());
+            total += old.blockLength(block);
+        };
+        for (size_t block = 0; block < first; block++) {
+            copyBlock(block);
+        }
+        for (const vector<uint64_t>& values : replacement) {
+            firsts.push_back(values[0]);
+            lengths.push_back(values.size());
+            for (size_t i = 1; i < values.size(); i++) {
+                appendVarint(deltas, values[i] - values[i - 1]);
+            }
+            ends.push_back(deltas.size());
+            total += values.size();
+        }
+        for (size_t block = first + count; block < oldBlocks; block++) {
+            copyBlock(block);
+        }
+
+        string encoded(POSTING_HEADER + firsts.size() * POSTING_SKIP_ENTRY, '\0');
+        uint32_t blocks = firsts.size();
+        memcpy(&encoded[0], &total, 8);
+        memcpy(&encoded[8], &blocks, 4);
+        for (size_t block = 0; block < firsts.size(); block++) {
+            char* entry = &encoded[POSTING_HEADER + block * POSTING_SKIP_ENTRY];
+            memcpy(entry, &firsts[block], 8);
+            memcpy(entry + 8, &lengths[block], 4);
+            memcpy(entry + 12, &ends[block], 4);
+        }
+        data = encoded + deltas;
+    }
+};
+
+// Interning table: every distinct string added is copied once into an arena of large
+// blocks and named by a dense handle, 0, 1, 2, ... in order of first sight. The hash table
+// holds handles, not strings, so nothing is stored twice, and lists of handles compare
+// and deduplicate as integers. Strings stay put until clear(), so views of them are stable.
+// Pools hold the strings kept on the heap: the in-memory changes of the secondary indices,
+// the keys of imports and rebuilds, and the trigram index's names. The primary B+trees
+// and the snapshot store their keys as bytes in their files and are not keyed by handle.
+const size_t STRING_POOL_BLOCK = 64 * 1024;
+const uint32_t NO_HANDLE = UINT32_MAX;
+
+class StringPool {
+public:
+    // Handle of text, adding it on first sight
+    uint32_t intern(string_view text) {
+        if (strings.size() * 2 >= buckets.size()) {
+            grow();
+        }
+        size_t bucket = lookup(text);
+        if (buckets[bucket] == NO_HANDLE) {
+            buckets[bucket] = strings.size();
+            strings.push_back(copy(text));
+        }
+        return buckets[bucket];
+    }
+
+    // Handle of text if it was added
+    bool find(string_view text, uint32_t& handle) const {
+        if (buckets.empty()) {
+            return false;
+        }
+        handle = buckets[lookup(text)];
+        return handle != NO_HANDLE;
+    }
+
+    string_view operator[](uint32_t handle) const { return strings[handle]; }
+
+    size_t size() const { return strings.size(); }
+
+    void clear() {
+        blocks.clear();
+        blockNext = nullptr;
+        blockFree = 0;
+        strings.clear();
+        buckets.clear();
+    }
+
+private:
+    vector<unique_ptr<char[]>> blocks;
+    char* blockNext = nullptr;
+    size_t blockFree = 0;
+    vector<string_view> strings; // handle -> text in the arena
+    vector<uint32_t> buckets;    // open addressing with linear probing; NO_HANDLE = empty
+
+    // Bucket holding text's handle, or the empty bucket where it would go
+    size_t lookup(string_view text) const {
+        size_t mask = buckets.size() - 1;
+        size_t bucket = hash<string_view>()(text) & mask;
+        while (buckets[bucket] != NO_HANDLE && strings[buckets[bucket]] != text) {
+            bucket = (bucket + 1) & mask;
+        }
+        return bucket;
+    }
+
+    void grow() {
+        buckets.assign(max<size_t>(16, buckets.size() * 2), NO_HANDLE);
+        for (uint32_t handle = 0; handle < strings.size(); handle++) {
+            buckets[lookup(strings[handle])] = handle;
+        }
+    }
+
+    string_view copy(string_view text) {
+        if (text.size() > blockFree || !blockNext) {
+            blockFree = max(STRING_POOL_BLOCK, text.size());
+            blocks.emplace_back(new char[blockFree]);
+            blockNext = blocks.back().get();
+        }
+        memcpy(blockNext, text.data(), text.size());
+        string_view stored(blockNext, text.size());
+        blockNext += text.size();
+        blockFree -= text.size();
+        return stored;
+    }
+};
+
+// In-memory posting list of string IDs: their handles in the index's StringPool
+using IdList = vector<uint32_t>;
+
+// How each kind of posting list is stored in a snapshot entry and changed in memory.
+// String IDs take one snapshot entry per ID and are interned in the index's pool; record
+// offsets take a single entry holding the encoded PostingList and ignore the pool.
+void loadPostings(const PostingTableView& table, size_t slot, IdList& ids, StringPool& pool) {
+    for (size_t i = 0; i < table.postingCount(slot); i++) {
+        ids.push_back(pool.intern(table.id(slot, i)));
+    }
+}
+
+void loadPostings(const PostingTableView& table, size_t slot, PostingList& list, StringPool&) {
+    list = PostingList(table.id(slot, 0));
+}
+
+void writePostings(PostingTableWriter& writer, const IdList& ids, const StringPool& pool) {
+    for (uint32_t id : ids) {
+        writer.addId(pool[id]);
+    }
+}
+
+void writePostings(PostingTableWriter& writer, const PostingList& list, const StringPool&) {
+    writer.addId(list.bytes());
+}
+
+// Copy a snapshot entry's postings unchanged
+void copySnapshotPostings(PostingTableWriter& writer, const PostingTableView& table, size_t slot, const IdList*) {
+    for (size_t i = 0; i < table.postingCount(slot); i++) {
+        writer.addId(table.id(slot, i));
+    }
+}
+
+void copySnapshotPostings(PostingTableWriter& writer, const PostingTableView& table, size_t slot, const PostingList*) {
+    writer.addId(table.id(slot, 0));
+}
+
+void addPosting(IdList& ids, StringPool& pool, string_view id) {
+    uint32_t handle = pool.intern(id);
+    if (find(ids.begin(), ids.end(), handle) == ids.end()) {
+        ids.push_back(handle);
+    }
+}
+
+void addPosting(PostingList& list, StringPool&, uint64_t position) {
+    list.insert(position);
+}
+
+// Bulk additions of IDs known to be new to the list
+void appendPostings(IdList& ids, StringPool& pool, const vector<string_view>& more) {
+    for (string_view id : more) {
+        ids.push_back(pool.intern(id));
+    }
+}
+
+void appendPostings(PostingList& list, StringPool&, const vector<uint64_t>& more) {
+    list.appendSorted(more);
+}
+
+void removePosting(IdList& ids, StringPool& pool, string_view id) {
+    uint32_t handle;
+    if (pool.find(id, handle)) {
+        ids.erase(remove(ids.begin(), ids.end(), handle), ids.end());
+    }
+}
+
+void removePosting(PostingList& list, StringPool&, uint64_t position) {
+    list.erase(position);
+}
+
+template <class Visit>
+void visitPostings(const IdList& ids, const StringPool& pool, Visit visit) {
+    for (uint32_t id : ids) {
+        visit(pool[id]);
+    }
+}
+
+template <class Visit>
+void visitPostings(const PostingList& list, const StringPool&, Visit visit) {
+    list.view().forEach(visit);
+}
+
+template <class Visit>
+void visitSnapshotPostings(const PostingTableView& table, size_t slot, Visit visit, const IdList*) {
+    for (size_t i = 0; i < table.postingCount(slot); i++) {
+        visit(table.id(slot, i));
+    }
+}
+
+template <class Visit>
+void visitSnapshotPostings(const PostingTableView& table, size_t slot, Visit visit, const PostingList*) {
+    PostingListView{table.id(slot, 0)}.forEach(visit);
+}
+
+// Secondary index (key -> posting list) served from the mapped snapshot taken at the
+// last checkpoint, with the keys changed since then held in memory. A key present in
+// `changed` overrides the snapshot; an empty list there means the key was removed. The
+// changed keys, and any string IDs listed under them, live once each in `strings`.
+template <class Postings>
+class SecondaryIndex {
+public:
+    PostingTableView snapshot;
+    map<string_view, Postings> changed;
+    StringPool strings;
+
+    bool contains(const string& key) const {
+        auto entry = changed.find(key);
+        if (entry != changed.end()) {
+            return !entry->second.empty();
+        }
+        size_t slot;
+        return snapshot.find(key, slot);
+    }
+
+    // Number of non-empty keys: the snapshot's, adjusted by keys added or emptied since
+    size_t keyCount() const {
+        size_t count = snapshot.keyCount;
+        size_t slot;
+        for (const auto& entry : changed) {
+            bool inSnapshot = snapshot.find(entry.first, slot);
+            if (!entry.second.empty() && !inSnapshot) {
+                count++;
+            } else if (entry.second.empty() && inSnapshot) {
+                count--;
+            }
+        }
+        return count;
+    }
+
+    // Visit the IDs (or record offsets) listed under key
+    template <class Visit>
+    void forEachId(const string& key, Visit visit) const {
+        auto entry = changed.find(key);
+        if (entry != changed.end()) {
+            visitPostings(entry->second, strings, visit);
+            return;
+        }
+        size_t slot;
+        if (snapshot.find(key, slot)) {
+            visitSnapshotPostings(snapshot, slot, visit, (const Postings*)nullptr);
+        }
+    }
+
+    // Encoded posting list under key, without copying (offset indices only)
+    PostingListView postings(const string& key) const {
+        auto entry = changed.find(key);
+        if (entry != changed.end()) {
+            return entry->second.view();
+        }
+        size_t slot;
+        if (snapshot.find(key, slot)) {
+            return PostingListView{snapshot.id(slot, 0)};
+        }
+        return PostingListView();
+    }
+
+    // Visit every non-empty key in sorted order, merging the snapshot with the changes
+    template <class Visit>
+    void forEachKey(Visit visit) const {
+        forEachEntryFrom("", [&](string_view key, const Postings*, size_t) {
+            visit(key);
+            return true;
+        });
+    }
+
+    // Visit the non-empty keys in [from, to) in sorted order; an empty to means no upper bound
+    template <class Visit>
+    void forEachKeyInRange(const string& from, const string& to, Visit visit) const {
+        forEachEntryFrom(from, [&](string_view key, const Postings*, size_t) {
+            if (!to.empty() && key >= to) {
+                return false;
+            }
+            visit(key);
+            return true;
+        });
+    }
+
+    // Visit the IDs (or record offsets) under every key in [from, to), key by key in sorted
+    // order; an empty to means no upper bound. The first key is found by binary search, so
+    // the cost is O(log n) plus the entries visited.
+    template <class Visit>
+    void forEachIdInRange(const string& from, const string& to, Visit visit) const {
+        forEachEntryFrom(from, [&](string_view key, const Postings* list, size_t slot) {
+            if (!to.empty() && key >= to) {
+                return false;
+            }
+            if (list) {
+                visitPostings(*list, strings, visit);
+            } else {
+                visitSnapshotPostings(snapshot, slot, visit, (const Postings*)nullptr);
+            }
+            return true;
+        });
+    }
+
+    // Estimated share of the keys in [from, to) (to empty: unbounded), or -1 if there are
+    // no keys; snapshot keys are counted by binary search, changed keys one by one
+    double keyShare(const string& from, const string& to) const {
+        size_t inRange = 0;
+        if (to.empty() || from < to) {
+            size_t low, high = snapshot.keyCount;
+            snapshot.find(from, low);
+            if (!to.empty()) {
+                snapshot.find(to, high);
+            }
+            auto last = to.empty() ? changed.end() : changed.lower_bound(to);
+            inRange = high - low + distance(changed.lower_bound(from), last);
+        }
+        size_t total = snapshot.keyCount + changed.size();
+        return total > 0 ? double(inRange) / total : -1;
+    }
+
+    template <class Id>
+    void add(const string& key, const Id& id) {
+        addPosting(touch(key), strings, id);
+    }
+
+    // Add many IDs under key at once (bulk loads); they must not be listed there already
+    template <class Id>
+    void addAll(const string& key, const vector<Id>& ids) {
+        appendPostings(touch(key), strings, ids);
+    }
+
+    template <class Id>
+    void remove(const string& key, const Id& id) {
+        Postings& list = touch(key);
+        removePosting(list, strings, id);
+        size_t slot;
+        if (list.empty() && !snapshot.find(key, slot)) {
+            changed.erase(key);
+        }
+    }
+
+    // Serialize the merged index in the PostingTableView layout
+    string serialize() const {
+        PostingTableWriter writer;
+        forEachKey([&](string_view key) {
+            writer.addKey(key);
+            auto entry = changed.find(key);
+            if (entry != changed.end()) {
+                writePostings(writer, entry->second, strings);
+            } else {
+                size_t slot;
+                snapshot.find(key, slot);
+                copySnapshotPostings(writer, snapshot, slot, (const Postings*)nullptr);
+            }
+        });
+        return writer.finish();
+    }
+
+    // Switch to a new snapshot that already contains every change
+    void reset(const PostingTableView& view) {
+        snapshot = view;
+        changed.clear();
+        strings.clear();
+    }
+
+private:
+    // Visit the non-empty keys >= from in sorted order, merging the snapshot with the changes,
+    // as visit(key, in-memory list or null, snapshot slot); stops when visit returns false
+    template <class Visit>
+    void forEachEntryFrom(const string& from, Visit visit) const {
+        size_t slot;
+        snapshot.find(from, slot);
+        auto entry = changed.lower_bound(from);
+        while (slot < snapshot.keyCount || entry != changed.end()) {
+            bool fromChanges = entry != changed.end() &&
+                               (slot >= snapshot.keyCount || string_view(entry->first) <= snapshot.key(slot));
+            if (fromChanges) {
+                if (slot < snapshot.keyCount && snapshot.key(slot) == entry->first) {
+                    slot++; // overridden by the in-memory entry
+                }
+                if (!entry->second.empty() && !visit(string_view(entry->first), &entry->second, 0)) {
+                    return;
+                }
+                ++entry;
+            } else if (!visit(snapshot.key(slot), nullptr, slot)) {
+                return;
+            } else {
+                slot++;
+            }
+        }
+    }
+
+    // In-memory copy of key's list, taken from the snapshot the first time the key changes
+    Postings& touch(const string& key) {
+        auto entry = changed.find(key);
+        if (entry != changed.end()) {
+            return entry->second;
+        }
+        Postings& list = changed[strings[strings.intern(key)]];
+        size_t slot;
+        if (snapshot.find(key, slot)) {
+            loadPostings(snapshot, slot, list, strings);
+        }
+        return list;
+    }
+};
+
+// Sortable key for a free-form appointment date: "YYYY-MM-DD", then " HH:MM:SS" when a time
+// is given. Accepts year-first (2024-03-07, 2024/3/7) and day-first (07/03/2024, 7.3.2024)
+// dates with '-', '/' or '.' separators, optionally followed by a space or 'T' and a time
+// "HH:MM[:SS]". False if text is not such a date.
+bool normalizeDate(string_view text, string& key) {
+    size_t start = text.find_first_not_of(" \t"), end = text.find_last_not_of(" \t");
+    if (start == string_view::npos) {
+        return false;
+    }
+    text = text.substr(start, end - start + 1);
+
+    int values[6] = {0, 0, 0, 0, 0, 0};
+    size_t digits[6] = {0, 0, 0, 0, 0, 0};
+    size_t pos = 0;
+    auto readNumber = [&](int i, size_t maxDigits) {
+        while (pos < text.size() && isdigit(static_cast<unsigned char>(text[pos])) && digits[i] < maxDigits) {
+            values[i] = values[i] * 10 + (text[pos++] - '0');
+            digits[i]++;
+        }
+        return digits[i] > 0;
+    };
+    auto accept = [&](char c) { return pos < text.size() && text[pos] == c && ++pos; };
+
+    // Three date numbers, both separated by the same character
+    if (!readNumber(0, 4) || pos >= text.size() || string_view("-/.").find(text[pos]) == string_view::npos) {
+        return false;
+    }
+    char separator = text[pos++];
+    if (!readNumber(1, 2) || !accept(separator) || !readNumber(2, 4)) {
+        return false;
+    }
+    int timeParts = 0;
+    if (accept(' ') || accept('T')) {
+        if (!readNumber(3, 2) || !accept(':') || !readNumber(4, 2)) {
+            return false;
+        }
+        timeParts = accept(':') ? (readNumber(5, 2) ? 3 : 0) : 2;
+        if (timeParts == 0) {
+            return false;
+        }
+    }
+    if (pos != text.size()) {
+        return false;
+    }
+
+    int year, month, day;
+    if (digits[0] == 4 && digits[2] <= 2) {
+        year = values[0], month = values[1], day = values[2];
+    } else if (digits[0] <= 2 && digits[2] == 4) {
+        day = values[0], month = values[1], year = values[2];
+    } else {
+        return false;
+    }
+    static const int monthDays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (month < 1 || month > 12 || day < 1 || day > monthDays[month - 1] || (month == 2 && day == 29 && !leap) ||
+        values[3] > 23 || values[4] > 59 || values[5] > 59) {
+        return false;
+    }
+    char buffer[32];
+    int length = timeParts > 0 ? snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d:%02d", year, month, day,
+                                          values[3], values[4], values[5])
+                               : snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d", year, month, day);
+    key.assign(buffer, length);
+    return true;
+}
+
+// SQL LIKE: '%' matches any run of characters and '_' any single character
+bool likeMatch(string_view text, string_view pattern) {
+    size_t t = 0, p = 0, starPattern = string_view::npos, starText = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && pattern[p] == '%') {
+            starPattern = p++;
+            starText = t;
+        } else if (p < pattern.size() && (pattern[p] == '_' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        } else if (starPattern != string_view::npos) {
+            // Let the last '%' absorb one more character and retry from there
+            p = starPattern + 1;
+            t = ++starText;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '%') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// Literal text a LIKE pattern starts with, before its first wildcard
+string likePrefix(const string& pattern) {
+    return pattern.substr(0, pattern.find_first_of("%_"));
+}
+
+// Smallest string after every string that starts with prefix, or "" if there is none
+string prefixEnd(string prefix) {
+    while (!prefix.empty() && (unsigned char)prefix.back() == 0xFF) {
+        prefix.pop_back();
+    }
+    if (!prefix.empty()) {
+        prefix.back()++;
+    }
+    return prefix;
+}
+
+// Indexes
+BPlusTree doctorPrimaryIndex(DOC_PRIMARY_INDEX_TREE_FILE);
+SecondaryIndex<IdList> doctorSecondaryIndex;           // name -> doctor IDs
+BPlusTree appointmentPrimaryIndex(APP_PRIMARY_INDEX_TREE_FILE);
+SecondaryIndex<PostingList> appointmentSecondaryIndex;  // doctor ID -> appointment offsets
+SecondaryIndex<PostingList> appointmentDateIndex;       // normalised date -> appointment offsets
+bool appointmentDateIndexLoaded = false;                // false: rebuild it from the records
+
+// Trigram index over the doctor names: every three-byte substring of a name maps to the
+// names containing it, so a '%abc%' pattern only has to test the names that hold all of
+// its trigrams. Built from doctorSecondaryIndex on first use and then kept up to date by
+// addName. Names are never removed: one whose doctors are all gone just has no IDs left.
+class NameTrigramIndex {
+public:
+    // Visit every name holding all trigrams of the pattern's literal runs, a superset of
+    // the names matching it; false, visiting nothing, if the pattern has no trigram
+    template <class Visit>
+    bool forEachCandidate(const string& pattern, Visit visit) {
+        vector<uint32_t> grams = patternTrigrams(pattern);
+        if (grams.empty()) {
+            return false;
+        }
+        ensureBuilt();
+        vector<const vector<uint32_t>*> lists;
+        for (uint32_t gram : grams) {
+            auto entry = postings.find(gram);
+            if (entry == postings.end()) {
+                return true; // no name holds this trigram
+            }
+            lists.push_back(&entry->second);
+        }
+        sort(lists.begin(), lists.end(), [](const auto* a, const auto* b) { return a->size() < b->size(); });
+        vector<uint32_t> matches = *lists[0], common;
+        for (size_t i = 1; i < lists.size() && !matches.empty(); i++) {
+            common.clear();
+            set_intersection(matches.begin(), matches.end(), lists[i]->begin(), lists[i]->end(), back_inserter(common));
+            matches.swap(common);
+        }
+        for (uint32_t number : matches) {
+            visit(names[number]);
+        }
+        return true;
+    }
+
+    // Share of the names holding the pattern's rarest trigram, or -1 if it has none
+    double share(const string& pattern) {
+        vector<uint32_t> grams = patternTrigrams(pattern);
+        if (grams.empty()) {
+            return -1;
+        }
+        ensureBuilt();
+        size_t rarest = names.size();
+        for (uint32_t gram : grams) {
+            auto entry = postings.find(gram);
+            rarest = min(rarest, entry == postings.end() ? 0 : entry->second.size());
+        }
+        return names.size() == 0 ? 0 : double(rarest) / names.size();
+    }
+
+    // Index a name given to a doctor; nothing to do before the index is first used
+    void addName(const string& name) {
+        if (built) {
+            add(name);
+        }
+    }
+
+    // Drop the index after bulk changes to the names; the next use rebuilds it
+    void invalidate() {
+        lock_guard<mutex> guard(buildLock);
+        built = false;
+        names.clear();
+        postings.clear();
+    }
+
+private:
+    mutex buildLock; // server workers may race to build it under the shared storage lock
+    atomic<bool> built{false};
+    StringPool names; // name number = handle
+    unordered_map<uint32_t, vector<uint32_t>> postings; // trigram -> name numbers, ascending
+
+    void ensureBuilt() {
+        if (built.load(memory_order_acquire)) {
+            return;
+        }
+        lock_guard<mutex> guard(buildLock);
+        if (!built.load(memory_order_relaxed)) {
+            doctorSecondaryIndex.forEachKey([&](string_view name) { add(name); });
+            built.store(true, memory_order_release);
+        }
+    }
+
+    void add(string_view name) {
+        size_t known = names.size();
+        uint32_t number = names.intern(name);
+        if (number < known) {
+            return;
+        }
+        vector<uint32_t> grams;
+        appendTrigrams(name, grams);
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        for (uint32_t gram : grams) {
+            postings[gram].push_back(number); // numbers only grow, so the lists stay sorted
+        }
+    }
+
+    static void appendTrigrams(string_view text, vector<uint32_t>& grams) {
+        for (size_t i = 0; i + 3 <= text.size(); i++) {
+            grams.push_back((unsigned char)text[i] << 16 | (unsigned char)text[i + 1] << 8 | (unsigned char)text[i + 2]);
+        }
+    }
+
+    // Trigrams of the literal runs between the wildcards of a LIKE pattern
+    static vector<uint32_t> patternTrigrams(const string& pattern) {
+        vector<uint32_t> grams;
+        size_t start = 0;
+        while (start <= pattern.size()) {
+            size_t end = pattern.find_first_of("%_", start);
+            end = end == string::npos ? pattern.size() : end;
+            appendTrigrams(string_view(pattern).substr(start, end - start), grams);
+            start = end + 1;
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+};
+
+NameTrigramIndex nameTrigrams;
+
+// Visit the doctor names matching a LIKE pattern: a key range of the ordered name index
+// when the pattern starts with literal text, else the trigram index when the pattern has
+// a literal run of three characters, else every name
+template <class Visit>
+void forEachNameLike(const string& pattern, Visit visit) {
+    string prefix = likePrefix(pattern);
+    auto test = [&](string_view name) {
+        if (likeMatch(name, pattern)) {
+            visit(name);
+        }
+    };
+    if (!prefix.empty()) {
+        doctorSecondaryIndex.forEachKeyInRange(prefix, prefixEnd(prefix), test);
+    } else if (!nameTrigrams.forEachCandidate(pattern, test)) {
+        doctorSecondaryIndex.forEachKey(test);
+    }
+}
+
+// Where operations print their results: cout, or a per-request buffer in server mode
+thread_local ostream* resultStream = &cout;
+
+ostream& results() {
+    return *resultStream;
+}
+
+// Delta log of index changes made since the last checkpoint
+ofstream indexLog;
+string indexLogBuffer; // delta log entries not yet written, see commitWrites()
+bool indexLogUnsynced = false;
+size_t pendingLogEntries = 0;
+
+// Function Prototypes
+void loadAllIndices();
+void saveAllIndices(bool force = false);
+void refreshFreeSlots();
+bool commitWrites(bool sync);
+void checkpointIndices();
+void replayIndexLog();
+void loadTextIndices();
+void rebuildAppointmentDateIndex();
+void rebuildAppointmentPostings();
+bool loadIndexSnapshot();
+void loaddoc_availList();
+void loadApp_availList();
+void savedoc_availList();
+void saveApp_availList();
+void addDoctor();
+void insertDoctor(const Doctor& doctor);
+void renameDoctor(const string& doctorId, const string& newName);
+void changeAppointmentDate(const string& appointmentId, const string& newDate);
+void searchDoctorByID(string_view doctorId);
+void searchDoctorByName(const string& name);
+void deleteDoctor(const string& doctorId);
+void deleteAppointment(const string& appointmentId);
+void addAppointment();
+void insertAppointment(const Appointment& appointment);
+void searchAppointmentByID(string_view appointmentId);
+void searchAppointmentByDoctor(const string& doctorId);
+void menu();
+void printStorageStats();
+void finishInterruptedCompaction();
+bool compactDoctors();
+bool compactAppointments();
+void compactIfFragmented();
+
+// Number of decimal digits in n
+size_t digitCount(size_t n) {
+    return to_string(n).size();
+}
+
+// Build a length header "N|" (zero-padded to width digits) for a body of bodySize bytes
+string lengthHeader(size_t bodySize, size_t width) {
+    string length = to_string(bodySize);
+    length.insert(0, width - min(width, length.size()), '0');
+    return length + "|";
+}
+
+// Result of parsing the slot that starts at a given offset; SLOT_UNREADABLE is a live slot
+// whose fields cannot be decoded
+enum SlotStatus { SLOT_OK, SLOT_DELETED, SLOT_TRUNCATED, SLOT_MALFORMED, SLOT_UNREADABLE };
+
+// Parse the "[*]N|" header at pos in data[0, size). On success record views the N body bytes
+// and slotSize is header + body.
+SlotStatus parseSlot(const char* data, size_t size, size_t pos, string_view& record, size_t& slotSize) {
+    size_t start = pos;
+    bool deleted = pos < size && data[pos] == '*';
+    if (deleted) {
+        pos++;
+    }
+    size_t length = 0;
+    size_t digitsStart = pos;
+    while (pos < size && isdigit(static_cast<unsigned char>(data[pos]))) {
+        length = length * 10 + (data[pos] - '0');
+        pos++;
+    }
+    if (pos >= size) {
+        return SLOT_TRUNCATED;
+    }
+    if (pos == digitsStart || data[pos] != '|') {
+        return SLOT_MALFORMED;
+    }
+    pos++; // skip '|'
+    if (size - pos < length) {
+        return SLOT_TRUNCATED;
+    }
+    record = string_view(data + pos, length);
+    slotSize = pos + length - start;
+    return deleted ? SLOT_DELETED : SLOT_OK;
+}
+
+// Split a record body "f1|f2|...|" into count fields without copying
+bool splitFields(string_view record, string_view* fields, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        size_t bar = record.find('|');
+        if (bar == string_view::npos) {
+            return false;
+        }
+        fields[i] = record.substr(0, bar);
+        record.remove_prefix(bar + 1);
+    }
+    return true;
+}
+
+// Parse the text slot at pos and split the fields of a live one
+SlotStatus parseTextSlot(const char* data, size_t size, size_t pos, string_view* fields, size_t& slotSize) {
+    string_view record;
+    SlotStatus status = parseSlot(data, size, pos, record, slotSize);
+    return status == SLOT_OK && !splitFields(record, fields, 3) ? SLOT_UNREADABLE : status;
+}
+
+// Fixed-slot layout, the alternative to the length-prefixed text layout, chosen per data
+// file with --convert-layout. The file starts with a FIXED_HEADER_SIZE header: the magic,
+// the slot size and the width of each field. Slots follow back to back from there. A slot
+// is a status byte, one length byte per field, then the fields, each zero-padded to its
+// width, so a record is read without parsing and the slot of an offset is computed.
+const char FIXED_MAGIC[8] = {'F', 'I', 'X', 'S', 'L', 'O', 'T', '1'};
+const size_t FIXED_HEADER_SIZE = 64;
+const size_t FIXED_SLOT_PREFIX = 4;
+const char FIXED_FREE = 0;
+const char FIXED_LIVE = 1;
+
+// Field widths in the fixed layout, at most 255 bytes each
+const size_t DOCTOR_FIELD_WIDTHS[3] = {BPT_MAX_KEY, 63, 95};                // id, name, address
+const size_t APPOINTMENT_FIELD_WIDTHS[3] = {BPT_MAX_KEY, 31, BPT_MAX_KEY}; // id, date, doctor id
+
+// Slot size for the given field widths, rounded up to 8 bytes
+size_t fixedSlotSize(const size_t* widths) {
+    size_t size = FIXED_SLOT_PREFIX + widths[0] + widths[1] + widths[2];
+    return (size + 7) / 8 * 8;
+}
+
+string fixedHeader(const size_t* widths) {
+    string header(FIXED_HEADER_SIZE, '\0');
+    memcpy(&header[0], FIXED_MAGIC, 8);
+    uint32_t values[4] = {(uint32_t)fixedSlotSize(widths), (uint32_t)widths[0], (uint32_t)widths[1],
+                          (uint32_t)widths[2]};
+    memcpy(&header[8], values, sizeof(values));
+    return header;
+}
+
+// Live fixed slot holding fields, or "" if a field is wider than its width
+string encodeFixedSlot(const string_view* fields, const size_t* widths) {
+    string slot(fixedSlotSize(widths), '\0');
+    slot[0] = FIXED_LIVE;
+    size_t offset = FIXED_SLOT_PREFIX;
+    for (size_t i = 0; i < 3; i++) {
+        if (fields[i].size() > widths[i]) {
+            return "";
+        }
+        slot[1 + i] = (char)fields[i].size();
+        memcpy(&slot[offset], fields[i].data(), fields[i].size());
+        offset += widths[i];
+    }
+    return slot;
+}
+
+// Bytes of record slots read by RecordStore::fieldsAt() since startup: the length header
+// and body of a text slot, or the whole slot in the fixed layout
+atomic<size_t> recordBytesRead{0};
+
+// Appends are buffered per data file up to this size; see RecordStore::writeAt
+const size_t APPEND_BUFFER_SIZE = 256 * 1024;
+
+// A data file opened once for the whole run. One read/write descriptor serves every
+// write; reads go through a read-only memory mapping and are handed out as string_views.
+// The file is remapped when appends grow it past the mapped size. The layout, text or
+// fixed-slot, is read from the start of the file when it is opened.
+
+struct RecordStore {
+    string path;
+    int fd = -1;
+    size_t fileSize = 0; // including the append buffer
+    size_t writtenSize = 0; // handed to the kernel; the append buffer starts here
+    string appendBuffer;
+    bool unsynced = false; // written since the last sync()
+    char* data = nullptr;
+    size_t mappedSize = 0;
+    bool fixed = false; // fixed-slot layout
+    size_t slotBytes = 0; // fixed layout: size of every slot
+    size_t fieldWidths[3] = {};
+    size_t generation = 0; // counts release()s, so cached views of the file can tell it changed
+
+    explicit RecordStore(const string& filePath) : path(filePath) {}
+
+    ~RecordStore() {
+        unmap();
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    void unmap() {
+        if (data) {
+            munmap(data, mappedSize);
+        }
+        data = nullptr;
+        mappedSize = 0;
+    }
+
+    // Open (creating if needed) the descriptor shared by all operations on this file
+    bool open() {
+        if (fd >= 0) {
+            return true;
+        }
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+        fileSize = st.st_size;
+        writtenSize = fileSize;
+        char header[FIXED_HEADER_SIZE];
+        fixed = fileSize >= FIXED_HEADER_SIZE && pread(fd, header, FIXED_HEADER_SIZE, 0) == (ssize_t)FIXED_HEADER_SIZE &&
+                memcmp(header, FIXED_MAGIC, 8) == 0;
+        if (fixed) {
+            uint32_t values[4];
+            memcpy(values, header + 8, sizeof(values));
+            slotBytes = values[0];
+            for (size_t i = 0; i < 3; i++) {
+                fieldWidths[i] = values[1 + i];
+            }
+            fixed = slotBytes >= fixedSlotSize(fieldWidths);
+        }
+        return true;
+    }
+
+    // Offset of the first slot
+    size_t firstSlot() const {
+        return fixed ? FIXED_HEADER_SIZE : 0;
+    }
+
+    // Parse the slot at pos of the mapping: its status, its size and, if live, its fields
+    SlotStatus slotAt(size_t pos, string_view* fields, size_t& slotSize) const {
+        if (!fixed) {
+            return parseTextSlot(data, mappedSize, pos, fields, slotSize);
+        }
+        if (pos < FIXED_HEADER_SIZE || (pos - FIXED_HEADER_SIZE) % slotBytes != 0) {
+            return SLOT_MALFORMED;
+        }
+        if (pos >= mappedSize || mappedSize - pos < slotBytes) {
+            return SLOT_TRUNCATED;
+        }
+        const char* slot = data + pos;
+        slotSize = slotBytes;
+        if (slot[0] != FIXED_LIVE) {
+            return slot[0] == FIXED_FREE ? SLOT_DELETED : SLOT_MALFORMED;
+        }
+        size_t offset = FIXED_SLOT_PREFIX;
+        for (size_t i = 0; i < 3; i++) {
+            size_t length = (unsigned char)slot[1 + i];
+            if (length > fieldWidths[i]) {
+                return SLOT_UNREADABLE;
+            }
+            fields[i] = string_view(slot + offset, length);
+            offset += fieldWidths[i];
+        }
+        return SLOT_OK;
+    }
+
+    // First slot boundary at or after pos, for splitting a scan into ranges
+    size_t slotBoundary(size_t pos) const;
+
+    // The delimited record "f1|f2|f3|" encoded as a slot of availableSize bytes (text) or
+    // slotBytes (fixed); "" if it does not fit the fixed layout's field widths
+    string encode(const string& record, size_t availableSize) const;
+
+    // True if the delimited record can be stored in this file
+    bool fits(const string& record) {
+        return !open() || !fixed || !encode(record, 0).empty();
+    }
+
+    // Offset at which the next appended record will start
+    long endOffset() {
+        return open() ? (long)fileSize : -1;
+    }
+
+    // Write bytes at position. Appends, and changes to records still in the append buffer,
+    // go to the buffer, which flush() writes out in one go; anything else is a positional
+    // write, which the mapping sees through the page cache. Before bytes on disk are
+    // overwritten, the pending changes are committed (without sync), so the file is never
+    // ahead of the delta log by more than the change being made.
+    bool writeAt(long position, const string& bytes) {
+        if (position < 0 || !open()) {
+            return false;
+        }
+        unsynced = true;
+        if ((size_t)position >= writtenSize) {
+            size_t offset = position - writtenSize;
+            if (appendBuffer.size() < offset + bytes.size()) {
+                appendBuffer.resize(offset + bytes.size());
+            }
+            appendBuffer.replace(offset, bytes.size(), bytes);
+            fileSize = max(fileSize, position + bytes.size());
+            return appendBuffer.size() < APPEND_BUFFER_SIZE || flush();
+        }
+        if (!commitWrites(false)) {
+            return false;
+        }
+        return writeFully(position, bytes.data(), bytes.size());
+    }
+
+    // Write the append buffer to the file
+    bool flush() {
+        if (appendBuffer.empty()) {
+            return true;
+        }
+        if (!writeFully(writtenSize, appendBuffer.data(), appendBuffer.size())) {
+            return false;
+        }
+        writtenSize += appendBuffer.size();
+        appendBuffer.clear();
+        return true;
+    }
+
+    // Flush and make everything written so far durable
+    bool sync() {
+        if (!unsynced) {
+            return true;
+        }
+        if (!flush() || fsync(fd) != 0) {
+            return false;
+        }
+        unsynced = false;
+        return true;
+    }
+
+    bool writeFully(size_t position, const char* bytes, size_t size) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = pwrite(fd, bytes + written, size - written, position + written);
+            if (n <= 0) {
+                return false;
+            }
+            written += n;
+        }
+        return true;
+    }
+
+    // Drop the descriptor and mapping so the next access opens whatever file is at path now
+    void release() {
+        flush();
+        unmap();
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fd = -1;
+        fileSize = 0;
+        writtenSize = 0;
+        unsynced = false;
+        fixed = false;
+        generation++;
+    }
+
+    // Map the whole file again if its size changed since the last mapping; buffered appends
+    // are written out first
+    bool remap() {
+        if (!open() || !flush()) {
+            return false;
+        }
+        if (data && fileSize == mappedSize) {
+            return true;
+        }
+        unmap();
+        if (fileSize == 0) {
+            return true;
+        }
+        void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<char*>(addr);
+        mappedSize = fileSize;
+        return true;
+    }
+
+    // Views of the fields of the live record at position; false for deleted, malformed or
+    // missing slots
+    bool fieldsAt(long position, string_view* fields, size_t* slotSize = nullptr) {
+        if (position < 0) {
+            return false;
+        }
+        size_t size = 0;
+        SlotStatus status = slotAt(position, fields, size);
+        if (status == SLOT_TRUNCATED || position >= (long)mappedSize) {
+            // The record may have been appended after the last mapping
+            if (!remap()) {
+                return false;
+            }
+            status = slotAt(position, fields, size);
+        }
+        if (slotSize) {
+            *slotSize = size;
+        }
+        if (status != SLOT_OK) {
+            return false;
+        }
+        recordBytesRead += size;
+        return true;
+    }
+};
+
+RecordStore doctorStore(DOCTOR_FILE);
+RecordStore appointmentStore(APP_FILE);
+
+// Length indicator and delimited fields, without newline, filling availableSize bytes.
+// When the record goes into a larger slot the padding is counted in the length,
+// so every slot on disk still describes its own size.
+string encodeSlot(const string& record, size_t availableSize) {
+    string newRecord = to_string(record.length()) + "|" + record;
+
+    // Pad the record with spaces to completely overwrite the deleted space
+    if (newRecord.size() < availableSize) {
+        for (size_t width = digitCount(record.length()); width <= digitCount(availableSize); width++) {
+            size_t bodySize = availableSize - width - 1;
+            if (bodySize >= record.length() && digitCount(bodySize) <= width) {
+                newRecord = lengthHeader(bodySize, width) + record;
+                newRecord.append(bodySize - record.length(), ' ');
+                break;
+            }
+        }
+    }
+    return newRecord;
+}
+
+string RecordStore::encode(const string& record, size_t availableSize) const {
+    if (!fixed) {
+        return encodeSlot(record, availableSize);
+    }
+    string_view fields[3];
+    return splitFields(record, fields, 3) ? encodeFixedSlot(fields, fieldWidths) : "";
+}
+
+// Write a record into the slot at position (see RecordStore::encode)
+bool writeDelimitedRecord(RecordStore& store, long position, const string& record, size_t availableSize) {
+    string slot = store.encode(record, availableSize);
+    return !slot.empty() && store.writeAt(position, slot);
+}
+
+// Mark the slot at position as deleted: "*N|" followed by the old bytes, same total size;
+// in the fixed layout, the status byte
+bool writeTombstone(RecordStore& store, long position, size_t slotSize) {
+    if (store.fixed) {
+        return store.writeAt(position, string(1, FIXED_FREE));
+    }
+    size_t width = digitCount(slotSize);
+    string header = "*" + lengthHeader(slotSize - width - 2, width);
+    return store.writeAt(position, header);
+}
+
+// Decode the doctor record at position into views over the mapping
+bool readDoctorAt(long position, DoctorView& doctor, size_t* slotSize = nullptr) {
+    string_view fields[3];
+    if (!doctorStore.fieldsAt(position, fields, slotSize)) {
+        return false;
+    }
+    doctor.id = fields[0];
+    doctor.name = fields[1];
+    doctor.address = fields[2];
+    return true;
+}
+
+// Decode the appointment record at position into views over the mapping
+bool readAppointmentAt(long position, AppointmentView& appointment, size_t* slotSize = nullptr) {
+    string_view fields[3];
+    if (!appointmentStore.fieldsAt(position, fields, slotSize)) {
+        return false;
+    }
+    appointment.id = fields[0];
+    appointment.date = fields[1];
+    appointment.doctorId = fields[2];
+    return true;
+}
+
+// Memory cap of the two record caches together; set with --cache-mb
+const size_t RECORD_CACHE_BYTES = 16 << 20;
+// Per-entry bookkeeping on top of the strings: list and hash nodes, shared_ptr control block
+const size_t RECORD_CACHE_ENTRY_OVERHEAD = 128;
+
+size_t cachedSize(const Doctor& doctor) {
+    return sizeof(Doctor) + doctor.id.capacity() + doctor.name.capacity() + doctor.address.capacity();
+}
+
+size_t cachedSize(const Appointment& appointment) {
+    return sizeof(Appointment) + appointment.id.capacity() + appointment.date.capacity() +
+           appointment.doctorId.capacity();
+}
+
+// Bounded LRU cache of decoded records by ID, so a hot record skips the primary index
+// lookup and the parse. Lookups hand out shared pointers: an entry evicted or invalidated
+// while a caller still holds it lives until it is released. Every change to a record must
+// erase its ID here.
+template <class Record>
+class RecordCache {
+public:
+    explicit RecordCache(size_t limitBytes) : limit(limitBytes) {}
+
+    shared_ptr<const Record> find(string_view id) {
+        lock_guard<mutex> guard(lock);
+        auto entry = entries.find(id);
+        if (entry == entries.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        order.splice(order.begin(), order, entry->second); // now the most recently used
+        return *entry->second;
+    }
+
+    void put(shared_ptr<const Record> record) {
+        lock_guard<mutex> guard(lock);
+        eraseEntry(record->id);
+        order.push_front(std::move(record));
+        entries.emplace(order.front()->id, order.begin());
+        bytes += footprint(*order.front());
+        evictToLimit();
+    }
+
+    void erase(string_view id) {
+        lock_guard<mutex> guard(lock);
+        eraseEntry(id);
+    }
+
+    void setLimit(size_t limitBytes) {
+        lock_guard<mutex> guard(lock);
+        limit = limitBytes;
+        evictToLimit();
+    }
+
+    void printStats(const string& label) {
+        lock_guard<mutex> guard(lock);
+        size_t lookups = hits + misses;
+        results() << label << " cache: " << entries.size() << " records, " << bytes << " of " << limit << " bytes, "
+                  << hits << " hits, " << misses << " misses";
+        if (lookups > 0) {
+            results() << " (" << 100.0 * hits / lookups << "% hit rate)";
+        }
+        results() << "\n";
+    }
+
+private:
+    mutex lock; // lookups reorder the list, so even readers take it
+    list<shared_ptr<const Record>> order; // most recently used first
+    unordered_map<string_view, typename list<shared_ptr<const Record>>::iterator> entries; // keys view the IDs
+    size_t bytes = 0;
+    size_t limit;
+    size_t hits = 0;
+    size_t misses = 0;
+
+    static size_t footprint(const Record& record) {
+        return cachedSize(record) + RECORD_CACHE_ENTRY_OVERHEAD;
+    }
+
+    void eraseEntry(string_view id) {
+        auto entry = entries.find(id);
+        if (entry != entries.end()) {
+            bytes -= footprint(**entry->second);
+            order.erase(entry->second);
+            entries.erase(entry);
+        }
+    }
+
+    void evictToLimit() {
+        while (bytes > limit && !order.empty()) {
+            eraseEntry(order.back()->id);
+        }
+    }
+};
+
+RecordCache<Doctor> doctorCache(RECORD_CACHE_BYTES / 2);
+RecordCache<Appointment> appointmentCache(RECORD_CACHE_BYTES / 2);
+
+// Decoded doctor by ID, from the cache or else read and cached; null if there is none
+shared_ptr<const Doctor> findDoctor(string_view doctorId) {
+    shared_ptr<const Doctor> doctor = doctorCache.find(doctorId);
+    long position;
+    DoctorView view;
+    if (doctor || !doctorPrimaryIndex.find(doctorId, position)) {
+        return doctor;
+    }
+    if (!readDoctorAt(position, view)) {
+        cerr << "Failed to read doctor record.\n";
+        return nullptr;
+    }
+    doctor = make_shared<const Doctor>(Doctor{string(view.id), string(view.name), string(view.address)});
+    doctorCache.put(doctor);
+    return doctor;
+}
+
+shared_ptr<const Appointment> findAppointment(string_view appointmentId) {
+    shared_ptr<const Appointment> appointment = appointmentCache.find(appointmentId);
+    long position;
+    AppointmentView view;
+    if (appointment || !appointmentPrimaryIndex.find(appointmentId, position)) {
+        return appointment;
+    }
+    if (!readAppointmentAt(position, view)) {
+        cerr << "Failed to read appointment record.\n";
+        return nullptr;
+    }
+    appointment = make_shared<const Appointment>(Appointment{string(view.id), string(view.doctorId), string(view.date)});
+    appointmentCache.put(appointment);
+    return appointment;
+}
+
+// Parallel scan of a data file for predicates that no index answers. The file is split
+// into byte ranges; each worker finds the first slot boundary in its range by checking
+// that a chain of "N|" headers parses from there, then evaluates the predicate on every
+// live record that starts in its range. The merge keeps a range's matches only when it
+// started exactly where the previous range's last record ended, and rescans it from there
+// otherwise, so a wrong resync can cost time but never results. In the fixed-slot layout
+// the ranges start at computed slot boundaries and are never rescanned.
+const size_t SCAN_CHUNK_SIZE = 4 << 20;
+const size_t SCAN_SYNC_RECORDS = 8;
+
+// True if SCAN_SYNC_RECORDS slots in a row (or all up to the end of the data) parse from pos
+bool slotChainAt(const char* data, size_t size, size_t pos) {
+    for (size_t i = 0; i < SCAN_SYNC_RECORDS && pos < size; i++) {
+        string_view fields[3];
+        size_t slotSize;
+        SlotStatus status = parseTextSlot(data, size, pos, fields, slotSize);
+        if (status != SLOT_OK && status != SLOT_DELETED) {
+            return false;
+        }
+        pos += slotSize;
+    }
+    return true;
+}
+
+// First slot boundary at or after pos. Every slot ends in '|' or padding, so only
+// positions right after one of those are tried.
+size_t findSlotBoundary(const char* data, size_t size, size_t pos) {
+    for (; pos < size; pos++) {
+        char c = data[pos];
+        if ((c == '*' || isdigit(static_cast<unsigned char>(c))) && (data[pos - 1] == '|' || data[pos - 1] == ' ') &&
+            slotChainAt(data, size, pos)) {
+            return pos;
+        }
+    }
+    return size;
+}
+
+size_t RecordStore::slotBoundary(size_t pos) const {
+    if (!fixed) {
+        return pos == 0 ? 0 : findSlotBoundary(data, mappedSize, pos);
+    }
+    if (pos <= FIXED_HEADER_SIZE) {
+        return FIXED_HEADER_SIZE;
+    }
+    return min(mappedSize, FIXED_HEADER_SIZE + (pos - FIXED_HEADER_SIZE + slotBytes - 1) / slotBytes * slotBytes);
+}
+
+// Run task(i) for every i in [0, count) on up to one thread per core
+template <class Task>
+void runParallel(size_t count, Task task) {
+    atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i; (i = next++) < count;) {
+            task(i);
+        }
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < min<size_t>(count, max(1u, thread::hardware_concurrency())); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (thread& t : workers) {
+        t.join();
+    }
+}
+
+// Scan the slots of the store's mapping starting in [pos, limit), calling
+// visit(partial, pos, status, fields, slotSize) for every live, unreadable or deleted one.
+// Returns the end of the last slot seen, or the mapped size if the data is damaged.
+template <class Partial, class Visit>
+size_t scanRange(const RecordStore& store, size_t pos, size_t limit, Partial& partial, Visit& visit) {
+    size_t size = store.mappedSize;
+    while (pos < limit && pos < size) {
+        string_view fields[3];
+        size_t slotSize;
+        SlotStatus status = store.slotAt(pos, fields, slotSize);
+        if (status == SLOT_MALFORMED || status == SLOT_TRUNCATED) {
+            return size;
+        }
+        visit(partial, pos, status, fields, slotSize);
+        pos += slotSize;
+    }
+    return pos;
+}
+
+// Scan the store's data file in parallel ranges, each collecting into its own Partial, and
+// return the partial results in file order. visit is called from several threads at once
+// and must only change the partial it is given.
+template <class Partial, class Visit>
+vector<Partial> scanSlots(RecordStore& store, Visit visit) {
+    if (!store.remap()) {
+        return {};
+    }
+    size_t size = store.mappedSize;
+    size_t chunkCount = max<size_t>(1, (size + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE);
+    vector<Partial> partials(chunkCount);
+    vector<size_t> starts(chunkCount), ends(chunkCount);
+    runParallel(chunkCount, [&](size_t i) {
+        size_t begin = i * SCAN_CHUNK_SIZE, limit = min(size, begin + SCAN_CHUNK_SIZE);
+        starts[i] = store.slotBoundary(begin);
+        ends[i] = scanRange(store, starts[i], limit, partials[i], visit);
+    });
+
+    size_t expected = store.firstSlot(); // where the record chain from the start of the file has got to
+    for (size_t i = 0; i < chunkCount; i++) {
+        size_t limit = min(size, (i + 1) * SCAN_CHUNK_SIZE);
+        if (expected >= limit) {
+            partials[i] = Partial(); // one record covers this whole range, or the data is damaged
+            continue;
+        }
+        if (starts[i] != expected) {
+            partials[i] = Partial();
+            ends[i] = scanRange(store, expected, limit, partials[i], visit);
+        }
+        expected = ends[i];
+    }
+    return partials;
+}
+
+// Offsets of the live records whose fields satisfy match(fields), in file order.
+// match is called from several threads at once and must not change shared state.
+template <class Match>
+vector<long> scanRecords(RecordStore& store, Match match) {
+    vector<long> matches;
+    auto visit = [&](vector<long>& chunk, size_t pos, SlotStatus status, const string_view* fields, size_t) {
+        if (status == SLOT_OK && match(fields)) {
+            chunk.push_back(pos);
+        }
+    };
+    for (const vector<long>& chunk : scanSlots<vector<long>>(store, visit)) {
+        matches.insert(matches.end(), chunk.begin(), chunk.end());
+    }
+    return matches;
+}
+
+// When changes are made durable, set with --sync: after every command that changes data,
+// at most every syncIntervalMs, or only at commit points (see saveAllIndices)
+enum SyncPolicy { SYNC_EVERY_WRITE, SYNC_INTERVAL, SYNC_AT_COMMIT };
+SyncPolicy syncPolicy = SYNC_AT_COMMIT;
+long syncIntervalMs = 0;
+chrono::steady_clock::time_point lastSync = chrono::steady_clock::now();
+size_t syncCount = 0;
+
+bool syncIntervalElapsed() {
+    return chrono::steady_clock::now() - lastSync >= chrono::milliseconds(syncIntervalMs);
+}
+
+// fsync a file by path, for files written through a stream
+bool syncFile(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+// Group commit: write the buffered appends of both data files, then the buffered delta log
+// entries that refer to them; with sync, fsync the data files before the log is written and
+// the log after. A crash loses a tail of changes but never logs an index entry whose record
+// was not written. The primary index trees come last: their pages only reach the file in
+// checkpointIndices(), after a synced commit, so no tree entry is durable before its record
+// and its log entry.
+bool commitWrites(bool sync) {
+    bool ok = doctorStore.flush() && appointmentStore.flush();
+    if (ok && sync) {
+        ok = doctorStore.sync() && appointmentStore.sync();
+    }
+    if (ok && !indexLogBuffer.empty()) {
+        if (!indexLog.is_open()) {
+            indexLog.open(INDEX_LOG_FILE, ios::app);
+        }
+        indexLog << indexLogBuffer;
+        indexLog.flush();
+        ok = indexLog.good();
+        if (ok) {
+            indexLogBuffer.clear();
+            indexLogUnsynced = true;
+        }
+    }
+    if (ok && sync) {
+        if (indexLogUnsynced) {
+            ok = syncFile(INDEX_LOG_FILE);
+            indexLogUnsynced = !ok;
+        }
+        lastSync = chrono::steady_clock::now();
+        syncCount++;
+    }
+    if (!ok) {
+        cerr << "Failed to commit writes.\n";
+    }
+    return ok;
+}
+
+// Called after each command that changed data; syncs if the policy asks for it now
+void writeCompleted() {
+    if (syncPolicy == SYNC_EVERY_WRITE || (syncPolicy == SYNC_INTERVAL && syncIntervalElapsed())) {
+        commitWrites(true);
+    }
+    refreshFreeSlots();
+}
+
+// Queue one change for the delta log: tag|op|key|value|
+void logIndexChange(const string& tag, char op, const string& key, const string& value = "") {
+    indexLogBuffer.append(tag).append("|").append(1, op).append("|").append(key).append("|").append(value).append("|\n");
+    pendingLogEntries++;
+    if (indexLogBuffer.size() >= APPEND_BUFFER_SIZE) {
+        commitWrites(false);
+    }
+}
+
+// Index mutation helpers: apply the change in memory and record it in the delta log
+void primaryPut(BPlusTree& index, const string& tag, const string& id, long position) {
+    index.put(id, position);
+    logIndexChange(tag, '+', id, to_string(position));
+}
+
+void primaryErase(BPlusTree& index, const string& tag, const string& id) {
+    index.erase(id);
+    logIndexChange(tag, '-', id);
+}
+
+void secondaryAdd(SecondaryIndex<IdList>& index, const string& tag, const string& key, const string& id) {
+    index.add(key, id);
+    logIndexChange(tag, '+', key, id);
+}
+
+void secondaryRemove(SecondaryIndex<IdList>& index, const string& tag, const string& key, const string& id) {
+    index.remove(key, id);
+    logIndexChange(tag, '-', key, id);
+}
+
+void postingAdd(SecondaryIndex<PostingList>& index, const string& tag, const string& key, uint64_t position) {
+    index.add(key, position);
+    logIndexChange(tag, '+', key, to_string(position));
+}
+
+void postingRemove(SecondaryIndex<PostingList>& index, const string& tag, const string& key, uint64_t position) {
+    index.remove(key, position);
+    logIndexChange(tag, '-', key, to_string(position));
+}
+
+// The date index lists only appointments whose date normalizeDate() understands
+void dateIndexAdd(string_view date, uint64_t position) {
+    string key;
+    if (normalizeDate(date, key)) {
+        postingAdd(appointmentDateIndex, "AD", key, position);
+    }
+}
+
+void dateIndexRemove(string_view date, uint64_t position) {
+    string key;
+    if (normalizeDate(date, key)) {
+        postingRemove(appointmentDateIndex, "AD", key, position);
+    }
+}
+
+// Smallest hole worth tracking: anything smaller left over from a split becomes padding
+const size_t MIN_HOLE_SIZE = 8;
+const size_t SIZE_CLASS_COUNT = 64;
+
+// Free-space manager for one data file. Holes are kept by offset, to find neighbours to
+// coalesce with, and in power-of-two size classes, for best-fit lookup. Every hole is also
+// a tombstone slot on disk, and every change is recorded in the delta log under `tag`.
+// A file in the fixed-slot layout has no holes: its free slots are bits of a bitmap built
+// from the slots' status bytes when the file is first used, and nothing is logged.
+class AvailList {
+public:
+    AvailList(RecordStore& file, const string& logTag) : store(file), tag(logTag), classes(SIZE_CLASS_COUNT) {}
+
+    const map<long, size_t>& holes() const { return byOffset; }
+    const string& logTag() const { return tag; }
+
+    // Take the smallest hole that fits size bytes. A tail big enough to stay useful is split
+    // off as a new hole; a smaller one is handed out with the slot as padding.
+    bool allocate(size_t size, long& position, size_t& slotSize) {
+        if (fixedLayout()) {
+            return allocateSlot(position, slotSize);
+        }
+        for (size_t sizeClass = classOf(size); sizeClass < SIZE_CLASS_COUNT; sizeClass++) {
+            auto best = classes[sizeClass].lower_bound({size, LONG_MIN});
+            if (best == classes[sizeClass].end()) {
+                continue;
+            }
+            position = best->second;
+            slotSize = best->first;
+            eraseHole(position);
+            logIndexChange(tag, '-', to_string(position));
+            if (slotSize - size >= MIN_HOLE_SIZE) {
+                long tail = position + size;
+                size_t tailSize = slotSize - size;
+                writeTombstone(store, tail, tailSize);
+                insertHole(tail, tailSize);
+                logIndexChange(tag, '+', to_string(tail), to_string(tailSize));
+                slotSize = size;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Turn the slot at position into free space, merged with any holes right before or after it
+    bool release(long position, size_t size) {
+        if (fixedLayout()) {
+            if (!writeTombstone(store, position, size)) {
+                return false;
+            }
+            setFree((position - store.firstSlot()) / store.slotBytes);
+            return true;
+        }
+        auto next = byOffset.lower_bound(position);
+        if (next != byOffset.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + (long)previous->second == position) {
+                position = previous->first;
+                size += previous->second;
+                logIndexChange(tag, '-', to_string(previous->first));
+                eraseHole(previous->first);
+            }
+        }
+        next = byOffset.find(position + size);
+        if (next != byOffset.end()) {
+            size += next->second;
+            logIndexChange(tag, '-', to_string(next->first));
+            eraseHole(next->first);
+        }
+        if (!writeTombstone(store, position, size)) {
+            return false;
+        }
+        insertHole(position, size);
+        logIndexChange(tag, '+', to_string(position), to_string(size));
+        return true;
+    }
+
+    // Raw changes used while loading and replaying: no disk writes, no logging
+    void insertHole(long position, size_t size) {
+        if (fixedFile()) {
+            return;
+        }
+        eraseHole(position);
+        byOffset[position] = size;
+        classes[classOf(size)].insert({size, position});
+        freeBytes += size;
+    }
+
+    void eraseHole(long position) {
+        auto hole = byOffset.find(position);
+        if (hole != byOffset.end()) {
+            classes[classOf(hole->second)].erase({hole->second, position});
+            freeBytes -= hole->second;
+            byOffset.erase(hole);
+        }
+    }
+
+    void clear() {
+        byOffset.clear();
+        for (auto& sizeClass : classes) {
+            sizeClass.clear();
+        }
+        freeBytes = 0;
+        bitmapGeneration = SIZE_MAX;
+    }
+
+    size_t totalFree() {
+        return fixedLayout() ? freeSlots * store.slotBytes : freeBytes;
+    }
+
+    size_t holeCount() {
+        return fixedLayout() ? freeSlots : byOffset.size();
+    }
+
+    size_t largestHole() const {
+        for (size_t sizeClass = SIZE_CLASS_COUNT; sizeClass-- > 0;) {
+            if (!classes[sizeClass].empty()) {
+                return classes[sizeClass].rbegin()->first;
+            }
+        }
+        return 0;
+    }
+
+    // Bring a fixed-slot file's bitmap up to date with the file
+    void refresh() {
+        fixedLayout();
+    }
+
+    // Read only: the bitmap of a fixed-slot file is kept current by refresh()
+    void printStats(const string& label, size_t fileSize) const {
+        if (store.fixed) {
+            size_t slots = (fileSize - min(fileSize, store.firstSlot())) / store.slotBytes;
+            results() << label << ": " << freeSlots << " of " << slots << " slots of " << store.slotBytes
+                      << " bytes free";
+            if (slots > 0) {
+                results() << " (" << 100.0 * freeSlots / slots << "%)";
+            }
+            results() << "\n";
+            return;
+        }
+        size_t largest = largestHole();
+        results() << label << ": " << byOffset.size() << " holes, " << freeBytes << " of " << fileSize << " bytes free";
+        if (fileSize > 0) {
+            results() << " (" << 100.0 * freeBytes / fileSize << "%)";
+        }
+        if (freeBytes > 0) {
+            results() << ", largest hole " << largest << " bytes, fragmentation "
+                 << 100.0 * (1.0 - double(largest) / freeBytes) << "%";
+        }
+        results() << "\n";
+        for (size_t sizeClass = 0; sizeClass < SIZE_CLASS_COUNT; sizeClass++) {
+            if (!classes[sizeClass].empty()) {
+                results() << "  holes of " << (sizeClass == 0 ? 0 : size_t(1) << (sizeClass - 1)) << "-"
+                     << (size_t(1) << sizeClass) - 1 << " bytes: " << classes[sizeClass].size() << "\n";
+            }
+        }
+    }
+
+    RecordStore& store;
+
+private:
+    string tag;
+    map<long, size_t> byOffset;
+    vector<set<pair<size_t, long>>> classes; // size class -> (size, offset), smallest first
+    size_t freeBytes = 0;
+    vector<uint64_t> freeBitmap; // fixed layout: bit i set = slot i free
+    size_t freeSlots = 0;
+    size_t searchFrom = 0; // no free slot in the bitmap words before this one
+    size_t bitmapGeneration = SIZE_MAX; // store generation the bitmap was built for
+
+    bool fixedFile() { return store.open() && store.fixed; }
+
+    // True for a fixed-slot file, whose bitmap is then up to date
+    bool fixedLayout() {
+        if (!fixedFile()) {
+            return false;
+        }
+        if (bitmapGeneration != store.generation) {
+            buildBitmap();
+        }
+        return true;
+    }
+
+    void buildBitmap() {
+        bitmapGeneration = store.generation;
+        freeBitmap.clear();
+        freeSlots = 0;
+        searchFrom = 0;
+        if (!store.remap()) {
+            return;
+        }
+        size_t first = store.firstSlot();
+        for (size_t pos = first; pos + store.slotBytes <= store.mappedSize; pos += store.slotBytes) {
+            if (store.data[pos] == FIXED_FREE) {
+                setFree((pos - first) / store.slotBytes);
+            }
+        }
+    }
+
+    void setFree(size_t slot) {
+        size_t word = slot / 64;
+        uint64_t bit = uint64_t(1) << (slot % 64);
+        if (word >= freeBitmap.size()) {
+            freeBitmap.resize(word + 1);
+        }
+        if (!(freeBitmap[word] & bit)) {
+            freeBitmap[word] |= bit;
+            freeSlots++;
+        }
+        searchFrom = min(searchFrom, word);
+    }
+
+    // Take the lowest free slot
+    bool allocateSlot(long& position, size_t& slotSize) {
+        for (; searchFrom < freeBitmap.size(); searchFrom++) {
+            uint64_t& word = freeBitmap[searchFrom];
+            if (word) {
+                size_t bit = __builtin_ctzll(word);
+                word &= word - 1;
+                freeSlots--;
+                position = store.firstSlot() + (searchFrom * 64 + bit) * store.slotBytes;
+                slotSize = store.slotBytes;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Size class = number of significant bits, so class c holds sizes in [2^(c-1), 2^c)
+    static size_t classOf(size_t size) {
+        size_t sizeClass = 0;
+        while (size) {
+            size >>= 1;
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+};
+
+AvailList doc_availList(doctorStore, "DA");
+AvailList app_availList(appointmentStore, "AA");
+
+// Rebuild the free-slot bitmap of any fixed-slot file that was replaced. Called after
+// loading and after every write, which the server runs under its exclusive lock, so that
+// read-only commands such as stats never build or remap anything.
+void refreshFreeSlots() {
+    doc_availList.refresh();
+    app_availList.refresh();
+}
+
+// Bytes a record occupies on disk with its length header
+size_t slotSizeFor(const string& record) {
+    return digitCount(record.size()) + 1 + record.size();
+}
+
+// Share of a record's size, in percent, added as padding to every slot that is written
+// for it (inserts, imports, relocations and compaction), so that an update that makes the
+// record longer can usually stay in place; set with --slack
+size_t slackPercent = 0;
+
+// Bytes of a new slot for a record of recordSize bytes, with the slack
+size_t slotSizeWithSlack(size_t recordSize) {
+    size_t needed = digitCount(recordSize) + 1 + recordSize;
+    return needed + needed * slackPercent / 100;
+}
+
+// Place a record in the best-fitting hole of the file, or append it. Returns its offset, or -1.
+long storeRecord(RecordStore& store, AvailList& availList, const string& record) {
+    size_t needed = store.open() && store.fixed ? store.slotBytes : slotSizeWithSlack(record.size());
+    long position;
+    size_t slotSize;
+    if (!availList.allocate(needed, position, slotSize)) {
+        position = store.endOffset();
+        slotSize = needed;
+    }
+    if (!writeDelimitedRecord(store, position, record, slotSize)) {
+        return -1;
+    }
+    return position;
+}
+
+// Replace the record in the slot at position. A record that fits is written in place, padded
+// to the slot; a longer one is stored like a new record and its old slot freed, and position
+// is set to where it went.
+bool updateRecord(RecordStore& store, AvailList& availList, long& position, size_t slotSize, const string& record) {
+    if (store.fixed || slotSizeFor(record) <= slotSize) {
+        return writeDelimitedRecord(store, position, record, slotSize);
+    }
+    long newPosition = storeRecord(store, availList, record);
+    if (newPosition < 0 || !availList.release(position, slotSize)) {
+        return false;
+    }
+    position = newPosition;
+    return true;
+}
+
+// True if text is a non-empty run of decimal digits that fits in a long
+bool isLogNumber(const string& text) {
+    return !text.empty() && text.size() < 19 && all_of(text.begin(), text.end(), ::isdigit);
+}
+
+// Split a delta log line "tag|op|key|value|" into its fields; false for a line that is not
+// complete and well formed, such as a torn write at the end of the log
+bool parseLogLine(const string& line, string& tag, char& op, string& key, string& value) {
+    if (line.empty() || line.back() != '|' || count(line.begin(), line.end(), '|') != 4) {
+        return false;
+    }
+    size_t opStart = line.find('|') + 1;
+    size_t keyStart = line.find('|', opStart) + 1;
+    size_t valueStart = line.find('|', keyStart) + 1;
+    tag = line.substr(0, opStart - 1);
+    key = line.substr(keyStart, valueStart - 1 - keyStart);
+    value = line.substr(valueStart, line.size() - 1 - valueStart);
+    if (keyStart - opStart != 2 || (line[opStart] != '+' && line[opStart] != '-')) {
+        return false;
+    }
+    op = line[opStart];
+
+    // Fields that are parsed as numbers must be numbers
+    bool add = op == '+';
+    if ((tag == "DP" || tag == "AP") && add) {
+        return isLogNumber(value);
+    }
+    if (tag == "DA" || tag == "AA") {
+        return isLogNumber(key) && (!add || isLogNumber(value));
+    }
+    return true;
+}
+
+// Re-apply the changes logged since the last checkpoint (replaying an entry twice is harmless).
+// Replay stops at the first line that is torn (no newline) or malformed, and the log is cut
+// there, so that new entries are not appended to a torn one; the entries after it are lost.
+void replayIndexLog() {
+    ifstream file(INDEX_LOG_FILE);
+    pendingLogEntries = 0;
+    if (!file) {
+        return;
+    }
+    string line;
+    bool appointmentsCompacted = false;
+    size_t replayed = 0; // bytes of the entries replayed
+    bool stopped = false;
+    while (getline(file, line)) {
+        string tag, key, value;
+        char op;
+        if (file.eof() || !parseLogLine(line, tag, op, key, value)) {
+            cerr << "Index log replay stopped at a torn or malformed entry: " << line << "\n";
+            stopped = true;
+            break;
+        }
+        replayed += line.size() + 1;
+        bool add = op == '+';
+
+        if (tag == "DP" || tag == "AP") {
+            BPlusTree& index = tag == "DP" ? doctorPrimaryIndex : appointmentPrimaryIndex;
+            if (add) index.put(key, stol(value));
+            else index.erase(key);
+        } else if (tag == "DS") {
+            if (add) doctorSecondaryIndex.add(key, value);
+            else doctorSecondaryIndex.remove(key, value);
+        } else if ((tag == "AS" || tag == "AD") && isLogNumber(value)) {
+            SecondaryIndex<PostingList>& index = tag == "AS" ? appointmentSecondaryIndex : appointmentDateIndex;
+            uint64_t position = stoull(value);
+            if (add) index.add(key, position);
+            else index.remove(key, position);
+        } else if (tag == "DA" || tag == "AA") {
+            AvailList& availList = tag == "DA" ? doc_availList : app_availList;
+            if (add) availList.insertHole(stol(key), stoul(value));
+            else availList.eraseHole(stol(key));
+        } else if (tag == "VC" && key == APP_FILE) {
+            appointmentsCompacted = true;
+        }
+        pendingLogEntries++;
+    }
+    file.close();
+    if (stopped && truncate(INDEX_LOG_FILE.c_str(), replayed) != 0) {
+        cerr << "Failed to truncate " << INDEX_LOG_FILE << ".\n";
+    }
+
+    // A compaction moved every appointment; list them at their new offsets
+    if (appointmentsCompacted) {
+        rebuildAppointmentPostings();
+    }
+}
+
+// Open a primary index tree; a new, empty tree imports the old text index file once
+void openPrimaryIndex(BPlusTree& index, const string& legacyTextFile) {
+    if (!index.open()) {
+        cerr << "Failed to open primary index.\n";
+        return;
+    }
+    if (index.size() > 0) {
+        return;
+    }
+    ifstream file(legacyTextFile);
+    string id;
+    long position;
+    while (file >> id >> position) {
+        index.put(id, position);
+    }
+}
+
+// Load all indices at the start of the program
+void loadAllIndices() {
+    // Swap in a compacted data file if a compaction was interrupted after its commit point
+    finishInterruptedCompaction();
+
+    // Open the primary index trees
+    openPrimaryIndex(doctorPrimaryIndex, DOC_PRIMARY_INDEX_FILE);
+    openPrimaryIndex(appointmentPrimaryIndex, APP_PRIMARY_INDEX_FILE);
+
+    // Map the binary snapshot of the secondary indices and avail lists;
+    // without one, import the text index files instead
+    if (!loadIndexSnapshot()) {
+        loadTextIndices();
+    }
+
+    // Bring the checkpoint up to date with the delta log
+    replayIndexLog();
+    indexLog.open(INDEX_LOG_FILE, ios::app);
+
+    // The text files and older snapshots have no date index
+    if (!appointmentDateIndexLoaded) {
+        rebuildAppointmentDateIndex();
+    }
+    refreshFreeSlots();
+}
+
+// Build the date index from the appointment records; the next checkpoint saves it
+void rebuildAppointmentDateIndex() {
+    map<string, vector<uint64_t>> offsetsByDate;
+    appointmentPrimaryIndex.forEach([&](string_view, long position) {
+        AppointmentView appointment;
+        string key;
+        if (readAppointmentAt(position, appointment) && normalizeDate(appointment.date, key)) {
+            offsetsByDate[key].push_back(position);
+        }
+        return true;
+    });
+    appointmentDateIndex.reset(PostingTableView());
+    for (auto& entry : offsetsByDate) {
+        sort(entry.second.begin(), entry.second.end());
+        appointmentDateIndex.addAll(entry.first, entry.second);
+    }
+    appointmentDateIndexLoaded = true;
+}
+
+// Import the secondary indices and avail lists from the text export format
+void loadTextIndices() {
+    // Load Doctor Secondary Index
+    ifstream file(DOC_SECONDARY_INDEX_FILE);
+    doctorSecondaryIndex.reset(PostingTableView());
+    if (file) {
+        string line;
+        while (getline(file, line)) {
+            istringstream iss(line);
+            string name, id;
+            iss >> name;
+            while (iss >> id) {
+                doctorSecondaryIndex.add(name, id);
+            }
+        }
+        file.close();
+    }
+
+    // Load Appointment Secondary Index; the date index is rebuilt from the records
+    file.open(APP_SECONDARY_INDEX_FILE);
+    appointmentSecondaryIndex.reset(PostingTableView());
+    appointmentDateIndexLoaded = false;
+    if (file) {
+        string line;
+        while (getline(file, line)) {
+            istringstream iss(line);
+            string key, appointmentId;
+            iss >> key;
+            while (iss >> appointmentId) {
+                // The text format lists appointment IDs; the index holds their record offsets
+                long position;
+                if (appointmentPrimaryIndex.find(appointmentId, position)) {
+                    appointmentSecondaryIndex.add(key, (uint64_t)position);
+                }
+            }
+        }
+        file.close();
+    }
+
+    // Load Availability List
+    loaddoc_availList();
+    loadApp_availList();
+}
+
+// Commit point: write out buffered changes, sync them unless the interval policy says it is
+// too early, and fold the delta log into a checkpoint once it grows large
+void saveAllIndices(bool force) {
+    commitWrites(force || syncPolicy != SYNC_INTERVAL || syncIntervalElapsed());
+    if (force || pendingLogEntries >= CHECKPOINT_THRESHOLD) {
+        checkpointIndices();
+    }
+    refreshFreeSlots();
+}
+
+// Write an index file to a temporary file, sync it and rename it into place
+bool writeIndexFile(const string& path, const string& contents) {
+    string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t n = ::write(fd, contents.data() + written, contents.size() - written);
+        if (n <= 0) {
+            ::close(fd);
+            return false;
+        }
+        written += n;
+    }
+    bool synced = fsync(fd) == 0;
+    ::close(fd);
+    return synced && rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+// Binary index snapshot: fixed header, then one 8-byte aligned section per index
+//   magic[8], uint32 version, uint32 sectionCount, uint64 headerChecksum,
+//   sectionCount x {uint64 offset, uint64 size, uint64 checksum}
+// The header checksum covers the section table and is checked on every load; section
+// checksums are checked by verifyIndexSnapshot() so that startup does not read the sections.
+const char SNAPSHOT_MAGIC[8] = {'I', 'D', 'X', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 3;
+const size_t SNAPSHOT_HEADER_SIZE = 256;
+enum SnapshotSection {
+    SNAP_DOC_SECONDARY,
+    SNAP_APP_SECONDARY,
+    SNAP_DOC_AVAIL,
+    SNAP_APP_AVAIL,
+    SNAP_APP_DATE,
+    SNAP_SECTION_COUNT
+};
+// Version 2 had a 128-byte header and every section but the date index
+const uint32_t SNAPSHOT_VERSION_NO_DATES = 2;
+const size_t SNAPSHOT_HEADER_SIZE_NO_DATES = 128;
+
+RecordStore indexSnapshot(INDEX_SNAPSHOT_FILE);
+
+// Avail list section: uint64 count, then count x {int64 position, uint64 size}
+string availSection(const AvailList& availList) {
+    uint64_t count = availList.holes().size();
+    string out(reinterpret_cast<const char*>(&count), 8);
+    for (const auto& entry : availList.holes()) {
+        int64_t position = entry.first;
+        uint64_t size = entry.second;
+        out.append(reinterpret_cast<const char*>(&position), 8);
+        out.append(reinterpret_cast<const char*>(&size), 8);
+    }
+    return out;
+}
+
+bool loadAvailSection(const char* data, size_t size, AvailList& availList) {
+    availList.clear();
+    uint64_t count;
+    if (size < 8 || (memcpy(&count, data, 8), 8 + count * 16 > size)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        int64_t position;
+        uint64_t slotSize;
+        memcpy(&position, data + 8 + i * 16, 8);
+        memcpy(&slotSize, data + 16 + i * 16, 8);
+        availList.insertHole(position, slotSize);
+    }
+    return true;
+}
+
+// Location of section in the mapped snapshot, or false if the table points outside the file
+bool snapshotSection(int section, const char*& data, size_t& size, uint64_t* sectionChecksum = nullptr) {
+    uint64_t entry[3];
+    memcpy(entry, indexSnapshot.data + 24 + section * sizeof(entry), sizeof(entry));
+    if (entry[0] > indexSnapshot.mappedSize || entry[1] > indexSnapshot.mappedSize - entry[0]) {
+        return false;
+    }
+    data = indexSnapshot.data + entry[0];
+    size = entry[1];
+    if (sectionChecksum) {
+        *sectionChecksum = entry[2];
+    }
+    return true;
+}
+
+// Map the snapshot and point the secondary indices at it. Only the header is read here;
+// the sections are paged in by the lookups that touch them.
+bool loadIndexSnapshot() {
+    struct stat st;
+    if (stat(INDEX_SNAPSHOT_FILE.c_str(), &st) != 0) {
+        return false;
+    }
+    indexSnapshot.release();
+    if (!indexSnapshot.remap() || indexSnapshot.mappedSize < SNAPSHOT_HEADER_SIZE_NO_DATES) {
+        cerr << "Index snapshot is truncated; falling back to the text index files.\n";
+        return false;
+    }
+    const char* header = indexSnapshot.data;
+    uint32_t version, sectionCount;
+    uint64_t headerChecksum;
+    memcpy(&version, header + 8, 4);
+    memcpy(&sectionCount, header + 12, 4);
+    memcpy(&headerChecksum, header + 16, 8);
+    bool hasDates = version == SNAPSHOT_VERSION && sectionCount == SNAP_SECTION_COUNT;
+    bool noDates = version == SNAPSHOT_VERSION_NO_DATES && sectionCount == SNAP_APP_DATE;
+    size_t headerSize = hasDates ? SNAPSHOT_HEADER_SIZE : SNAPSHOT_HEADER_SIZE_NO_DATES;
+    if (memcmp(header, SNAPSHOT_MAGIC, 8) != 0 || (!hasDates && !noDates) || indexSnapshot.mappedSize < headerSize ||
+        headerChecksum != checksum(header + 24, headerSize - 24)) {
+        cerr << "Index snapshot header is invalid; falling back to the text index files.\n";
+        return false;
+    }
+
+    const char* data;
+    size_t size;
+    PostingTableView doctorView, appointmentView, dateView;
+    if (!snapshotSection(SNAP_DOC_SECONDARY, data, size) || !doctorView.attach(data, size) ||
+        !snapshotSection(SNAP_APP_SECONDARY, data, size) || !appointmentView.attach(data, size) ||
+        !snapshotSection(SNAP_DOC_AVAIL, data, size) || !loadAvailSection(data, size, doc_availList) ||
+        !snapshotSection(SNAP_APP_AVAIL, data, size) || !loadAvailSection(data, size, app_availList) ||
+        (hasDates && (!snapshotSection(SNAP_APP_DATE, data, size) || !dateView.attach(data, size)))) {
+        cerr << "Index snapshot sections are invalid; falling back to the text index files.\n";
+        return false;
+    }
+    doctorSecondaryIndex.reset(doctorView);
+    appointmentSecondaryIndex.reset(appointmentView);
+    appointmentDateIndex.reset(dateView);
+    appointmentDateIndexLoaded = hasDates;
+    return true;
+}
+
+// Write a new snapshot file of the secondary indices and avail lists; only reads them, the
+// switch to the new file is loadIndexSnapshot()
+bool writeIndexSnapshot() {
+    string sections[SNAP_SECTION_COUNT] = {
+        doctorSecondaryIndex.serialize(),
+        appointmentSecondaryIndex.serialize(),
+        availSection(doc_availList),
+        availSection(app_availList),
+        appointmentDateIndex.serialize(),
+    };
+
+    string snapshot(SNAPSHOT_HEADER_SIZE, '\0');
+    memcpy(&snapshot[0], SNAPSHOT_MAGIC, 8);
+    uint32_t version = SNAPSHOT_VERSION, sectionCount = SNAP_SECTION_COUNT;
+    memcpy(&snapshot[8], &version, 4);
+    memcpy(&snapshot[12], &sectionCount, 4);
+    for (int i = 0; i < SNAP_SECTION_COUNT; i++) {
+        uint64_t entry[3] = {snapshot.size(), sections[i].size(), checksum(sections[i].data(), sections[i].size())};
+        memcpy(&snapshot[24 + i * sizeof(entry)], entry, sizeof(entry));
+        snapshot += sections[i];
+        snapshot.append((8 - snapshot.size() % 8) % 8, '\0'); // keep the next section 8-byte aligned
+    }
+    uint64_t headerChecksum = checksum(&snapshot[24], SNAPSHOT_HEADER_SIZE - 24);
+    memcpy(&snapshot[16], &headerChecksum, 8);
+
+    if (!writeIndexFile(INDEX_SNAPSHOT_FILE, snapshot)) {
+        cerr << "Failed to write index snapshot.\n";
+        return false;
+    }
+    return true;
+}
+
+// Check every section of the snapshot against its checksum
+bool verifyIndexSnapshot() {
+    if (!loadIndexSnapshot()) {
+        return false;
+    }
+    int sectionCount = appointmentDateIndexLoaded ? SNAP_SECTION_COUNT : SNAP_APP_DATE;
+    for (int i = 0; i < sectionCount; i++) {
+        const char* data;
+        size_t size;
+        uint64_t expected;
+        if (!snapshotSection(i, data, size, &expected) || checksum(data, size) != expected) {
+            cerr << "Index snapshot section " << i << " is corrupt.\n";
+            return false;
+        }
+    }
+    cout << "Index snapshot checksums are valid.\n";
+    return true;
+}
+
+// Check the indices against each other and the data files, after the delta log is replayed:
+// every primary index entry must point at a live record with its ID, and every secondary
+// index entry at a record that the primary index points at and that has the entry's key.
+// The first few problems are printed.
+bool verifyIndices() {
+    if (!verifyIndexSnapshot()) {
+        return false;
+    }
+    loadAllIndices();
+    size_t problems = 0;
+    auto report = [&](const string& problem) {
+        if (problems++ < 10) {
+            cerr << problem << "\n";
+        }
+    };
+
+    auto checkPrimary = [&](const string& label, BPlusTree& index, RecordStore& store) {
+        size_t entries = 0;
+        index.forEach([&](string_view id, long position) {
+            entries++;
+            string_view fields[3];
+            if (!store.fieldsAt(position, fields)) {
+                report(label + " " + string(id) + ": no live record at offset " + to_string(position));
+            } else if (fields[0] != id) {
+                report(label + " " + string(id) + ": the record at offset " + to_string(position) + " is " +
+                       string(fields[0]));
+            }
+        });
+        if (entries != index.size()) {
+            report(label + " index: " + to_string(entries) + " entries, but its header counts " +
+                   to_string(index.size()));
+        }
+        return entries;
+    };
+    size_t doctors = checkPrimary("Doctor", doctorPrimaryIndex, doctorStore);
+    size_t appointments = checkPrimary("Appointment", appointmentPrimaryIndex, appointmentStore);
+
+    doctorSecondaryIndex.forEachKey([&](string_view name) {
+        doctorSecondaryIndex.forEachId(string(name), [&](string_view id) {
+            long position;
+            DoctorView doctor;
+            if (!doctorPrimaryIndex.find(id, position) || !readDoctorAt(position, doctor)) {
+                report("Name index: " + string(name) + " lists doctor " + string(id) + ", which does not exist");
+            } else if (doctor.name != name) {
+                report("Name index: " + string(name) + " lists doctor " + string(id) + ", named " +
+                       string(doctor.name));
+            }
+        });
+    });
+
+    // Offset indices: key(appointment, key) gives the key the appointment belongs under
+    auto checkOffsets = [&](const string& label, const SecondaryIndex<PostingList>& index, auto key) {
+        string expected;
+        index.forEachKey([&](string_view listed) {
+            index.forEachId(string(listed), [&](uint64_t position) {
+                AppointmentView appointment;
+                long indexed;
+                if (!readAppointmentAt(position, appointment) ||
+                    !appointmentPrimaryIndex.find(appointment.id, indexed) || indexed != (long)position) {
+                    report(label + ": " + string(listed) + " lists offset " + to_string(position) +
+                           ", which holds no indexed appointment");
+                } else if (!key(appointment, expected) || expected != listed) {
+                    report(label + ": " + string(listed) + " lists appointment " + string(appointment.id) +
+                           ", which belongs under " + expected);
+                }
+            });
+        });
+    };
+    checkOffsets("Doctor ID index", appointmentSecondaryIndex, [](const AppointmentView& appointment, string& key) {
+        key.assign(appointment.doctorId);
+        return true;
+    });
+    checkOffsets("Date index", appointmentDateIndex, [](const AppointmentView& appointment, string& key) {
+        key.clear();
+        return normalizeDate(appointment.date, key);
+    });
+
+    if (problems > 0) {
+        cout << "Indices are inconsistent: " << problems << " problems.\n";
+        return false;
+    }
+    cout << "Indices are consistent: " << doctors << " doctors, " << appointments << " appointments.\n";
+    return true;
+}
+
+// Look up the first record of a data file by ID, past the record cache, and check that the
+// lookup read that one slot and nothing else. The expected size is taken from the file
+// itself: the "N|" header plus N bytes in the text layout, one slot in the fixed layout.
+template <class Lookup>
+bool checkLookupBytes(const string& label, BPlusTree& index, RecordStore& store, Lookup lookup) {
+    string id;
+    long position = -1;
+    index.forEachFrom("", [&](string_view key, long value) {
+        id = string(key);
+        position = value;
+        return false;
+    });
+    if (position < 0) {
+        cout << label << ": no records, nothing to check.\n";
+        return true;
+    }
+
+    if (!store.open()) {
+        cerr << "Cannot open " << store.path << ".\n";
+        return false;
+    }
+    size_t expected = store.slotBytes;
+    if (!store.fixed) {
+        ifstream file(store.path, ios::binary);
+        file.seekg(position);
+        size_t length;
+        char bar;
+        if (!(file >> length) || !file.get(bar) || bar != '|') {
+            cerr << label << " " << id << ": no length header at offset " << position << ".\n";
+            return false;
+        }
+        expected = digitCount(length) + 1 + length;
+    }
+
+    size_t before = recordBytesRead;
+    if (!lookup(id)) {
+        cerr << label << " " << id << ": lookup failed.\n";
+        return false;
+    }
+    size_t read = recordBytesRead - before;
+    cout << label << " " << id << ": read " << read << " bytes, expected " << expected << ".\n";
+    return read == expected;
+}
+
+// Check the bytes read per lookup in both data files
+bool checkRecordReads() {
+    loadAllIndices();
+    doctorCache.setLimit(0);
+    appointmentCache.setLimit(0);
+    bool doctorsOk = checkLookupBytes("Doctor", doctorPrimaryIndex, doctorStore,
+                                      [](string_view id) { return findDoctor(id) != nullptr; });
+    bool appointmentsOk = checkLookupBytes("Appointment", appointmentPrimaryIndex, appointmentStore,
+                                           [](string_view id) { return findAppointment(id) != nullptr; });
+    return doctorsOk && appointmentsOk;
+}
+
+// A checkpoint is taken in two steps after a synced commit, so that the slow one only reads
+// the indices and a server can let readers in meanwhile (see serveRequest):
+// writeCheckpoint() writes back the primary index trees and writes the snapshot file, and
+// finishCheckpoint() switches to the new snapshot and starts a fresh delta log. Nothing may
+// change the indices between the two. A crash in between replays the whole log onto the
+// new snapshot, which is harmless.
+bool writeCheckpoint() {
+    // The primary index trees only need their dirty pages written back; this is the only
+    // place they are written, so they follow the data files and the log
+    doctorPrimaryIndex.flush();
+    appointmentPrimaryIndex.flush();
+    return writeIndexSnapshot();
+}
+
+void finishCheckpoint() {
+    // Keep the delta log if the new snapshot cannot be loaded
+    if (!loadIndexSnapshot()) {
+        return;
+    }
+
+    // Everything in the delta log is now part of the checkpoint
+    indexLog.close();
+    indexLog.open(INDEX_LOG_FILE, ios::trunc);
+    indexLogUnsynced = true;
+    pendingLogEntries = 0;
+}
+
+// Write a full checkpoint of all indices and start a fresh delta log
+void checkpointIndices() {
+    // The checkpoint may only cover records that are durable, and their log entries
+    if (commitWrites(true) && writeCheckpoint()) {
+        finishCheckpoint();
+    }
+}
+
+// Export every index in the text format (one entry or key per line)
+void exportIndicesText() {
+    ostringstream file;
+    doctorPrimaryIndex.forEach([&](string_view id, long position) {
+        file << id << " " << position << "\n";
+    });
+    writeIndexFile(DOC_PRIMARY_INDEX_FILE, file.str());
+
+    file.str("");
+    doctorSecondaryIndex.forEachKey([&](string_view name) {
+        file << name;
+        doctorSecondaryIndex.forEachId(string(name), [&](string_view id) { file << " " << id; });
+        file << "\n";
+    });
+    writeIndexFile(DOC_SECONDARY_INDEX_FILE, file.str());
+
+    file.str("");
+    appointmentPrimaryIndex.forEach([&](string_view id, long position) {
+        file << id << " " << position << "\n";
+    });
+    writeIndexFile(APP_PRIMARY_INDEX_FILE, file.str());
+
+    file.str("");
+    appointmentSecondaryIndex.forEachKey([&](string_view doctorId) {
+        file << doctorId;
+        appointmentSecondaryIndex.forEachId(string(doctorId), [&](uint64_t position) {
+            AppointmentView appointment;
+            if (readAppointmentAt(position, appointment)) {
+                file << " " << appointment.id;
+            }
+        });
+        file << "\n";
+    });
+    writeIndexFile(APP_SECONDARY_INDEX_FILE, file.str());
+
+    savedoc_availList();
+    saveApp_availList();
+    cout << "Indices exported to text files.\n";
+}
+
+// Compaction rewrites a data file without its tombstones once at least this share of it is free
+const double COMPACTION_THRESHOLD = 0.5;
+const size_t COMPACTION_MIN_FILE_SIZE = 64 * 1024;
+const size_t COMPACTION_BUFFER_SIZE = 1 << 20;
+
+// Buffered sequential writer for compaction and bulk import; memory stays at one buffer
+struct SequentialWriter {
+    int fd = -1;
+    string buffer;
+    size_t written = 0;
+
+    // Start a new file, or continue at the end of an existing one; written counts from
+    // the start of the file either way
+    bool open(const string& path, bool append = false) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            return false;
+        }
+        written = st.st_size;
+        return true;
+    }
+
+    bool write(string_view bytes) {
+        buffer += bytes;
+        written += bytes.size();
+        return buffer.size() < COMPACTION_BUFFER_SIZE || flushBuffer();
+    }
+
+    bool flushBuffer() {
+        size_t done = 0;
+        while (done < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        buffer.clear();
+        return true;
+    }
+
+    // Write out what is buffered, sync and close; the file is durable when this returns true
+    bool finish() {
+        bool ok = flushBuffer() && fsync(fd) == 0;
+        ::close(fd);
+        fd = -1;
+        return ok;
+    }
+};
+
+// One delta log line, in the format written by logIndexChange()
+string logLine(const string& tag, char op, const string& key, const string& value = "") {
+    return tag + "|" + op + "|" + key + "|" + value + "|\n";
+}
+
+// Rewrite one data file without tombstones, padding or unindexed records and remap its indices.
+//   1. Checkpoint, so the delta log is empty and the snapshot holds every index.
+//   2. Copy the live records sequentially into path.compact and sync it.
+//   3. Write a new delta log that starts with "VC|+|path||" and holds the remapped primary
+//      offsets and the removal of every hole; sync it and rename it over the empty log.
+//      This is the commit point.
+//   4. Rename path.compact over the data file, replay the log and checkpoint again.
+// Every record moves, so the indices of record offsets (the appointment doctor ID and date
+// indices) are not logged record by record: replayIndexLog() rebuilds them in one pass over
+// the new file when it meets the VC line.
+// A crash after step 3 is finished by finishInterruptedCompaction() at the next start;
+// a crash before it leaves the old file and indices untouched.
+bool compactDataFile(RecordStore& store, AvailList& availList, BPlusTree& primaryIndex, const string& primaryTag) {
+    auto started = chrono::steady_clock::now();
+    checkpointIndices();
+    if (pendingLogEntries > 0 || !store.remap()) {
+        cerr << "Compaction of " << store.path << " aborted: indices could not be checkpointed.\n";
+        return false;
+    }
+    size_t oldSize = store.fileSize;
+    if (store.data) {
+        madvise(store.data, store.mappedSize, MADV_SEQUENTIAL);
+    }
+
+    string compactPath = store.path + ".compact";
+    string logPath = INDEX_LOG_FILE + ".compact";
+    SequentialWriter dataOut, logOut;
+    if (!dataOut.open(compactPath) || !logOut.open(logPath)) {
+        cerr << "Compaction of " << store.path << " aborted: cannot create temporary files.\n";
+        return false;
+    }
+    bool ok = logOut.write(logLine("VC", '+', store.path));
+    if (store.fixed) {
+        ok = ok && dataOut.write(fixedHeader(store.fieldWidths));
+    }
+
+    // Visit every record the primary index still points at, with its fields; false if the
+    // file holds a malformed slot. A torn append at the end of the file is dropped.
+    auto forEachLiveRecord = [&](auto visit) {
+        for (size_t pos = store.firstSlot(); pos < store.mappedSize;) {
+            string_view fields[3];
+            size_t slotSize;
+            SlotStatus status = store.slotAt(pos, fields, slotSize);
+            if (status == SLOT_TRUNCATED) {
+                break;
+            }
+            if (status == SLOT_MALFORMED) {
+                cerr << "Compaction of " << store.path << " aborted: malformed record at offset " << pos << ".\n";
+                return false;
+            }
+            long indexed;
+            if (status == SLOT_OK && primaryIndex.find(fields[0], indexed) &&
+                indexed == (long)pos && !visit(pos, fields)) {
+                return false;
+            }
+            pos += slotSize;
+        }
+        return true;
+    };
+
+    // Copy the records and log their new primary offsets
+    size_t liveRecords = 0;
+    ok = ok && forEachLiveRecord([&](size_t, string_view* fields) {
+        string body = string(fields[0]) + "|" + string(fields[1]) + "|" + string(fields[2]) + "|";
+        long newPosition = dataOut.written;
+        liveRecords++;
+        return dataOut.write(store.encode(body, slotSizeWithSlack(body.size()))) &&
+               logOut.write(logLine(primaryTag, '+', string(fields[0]), to_string(newPosition)));
+    });
+    for (const auto& hole : availList.holes()) {
+        ok = ok && logOut.write(logLine(availList.logTag(), '-', to_string(hole.first)));
+    }
+    size_t newSize = dataOut.written;
+    ok = dataOut.finish() && logOut.finish() && ok;
+    if (!ok) {
+        cerr << "Compaction of " << store.path << " failed; the data file is unchanged.\n";
+        unlink(compactPath.c_str());
+        unlink(logPath.c_str());
+        return false;
+    }
+
+    // Commit: the new log names the compacted file, then the file is swapped in
+    indexLog.close();
+    if (rename(logPath.c_str(), INDEX_LOG_FILE.c_str()) != 0) {
+        cerr << "Compaction of " << store.path << " failed; the data file is unchanged.\n";
+        unlink(compactPath.c_str());
+        unlink(logPath.c_str());
+        indexLog.open(INDEX_LOG_FILE, ios::app);
+        return false;
+    }
+    store.release();
+    if (rename(compactPath.c_str(), store.path.c_str()) != 0) {
+        cerr << "Failed to swap in " << compactPath << "; it will be retried at the next start.\n";
+        return false;
+    }
+    replayIndexLog();
+    indexLog.open(INDEX_LOG_FILE, ios::app);
+    checkpointIndices();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    results() << "Compacted " << store.path << ": " << liveRecords << " records, " << oldSize << " -> " << newSize
+         << " bytes (" << oldSize - newSize << " reclaimed) in " << seconds << " s\n";
+    return true;
+}
+
+// Finish a compaction whose delta log was committed but whose data file was not swapped in yet
+void finishInterruptedCompaction() {
+    ifstream file(INDEX_LOG_FILE);
+    string line;
+    if (!getline(file, line)) {
+        return;
+    }
+    for (const string& path : {DOCTOR_FILE, APP_FILE}) {
+        string compactPath = path + ".compact";
+        if (line + "\n" == logLine("VC", '+', path) && access(compactPath.c_str(), F_OK) == 0) {
+            rename(compactPath.c_str(), path.c_str());
+        }
+    }
+}
+
+bool compactDoctors() {
+    return compactDataFile(doctorStore, doc_availList, doctorPrimaryIndex, "DP");
+}
+
+bool compactAppointments() {
+    return compactDataFile(appointmentStore, app_availList, appointmentPrimaryIndex, "AP");
+}
+
+// Compact any data file that is large enough and mostly free space
+void compactIfFragmented() {
+    long doctorSize = doctorStore.endOffset();
+    if (doctorSize >= (long)COMPACTION_MIN_FILE_SIZE && doc_availList.totalFree() >= COMPACTION_THRESHOLD * doctorSize) {
+        compactDoctors();
+    }
+    long appointmentSize = appointmentStore.endOffset();
+    if (appointmentSize >= (long)COMPACTION_MIN_FILE_SIZE &&
+        app_availList.totalFree() >= COMPACTION_THRESHOLD * appointmentSize) {
+        compactAppointments();
+    }
+}
+
+// Split one CSV line into count fields. A field may be double-quoted, with "" for a quote
+// inside it. False when the field count is wrong or a field holds the record delimiter.
+bool parseCsvLine(string_view line, string* fields, size_t count) {
+    size_t field = 0;
+    size_t pos = 0;
+    while (true) {
+        if (field == count) {
+            return false;
+        }
+        string& out = fields[field];
+        out.clear();
+        if (pos < line.size() && line[pos] == '"') {
+            pos++;
+            while (true) {
+                if (pos >= line.size()) {
+                    return false; // unterminated quote
+                }
+                if (line[pos] == '"') {
+                    if (pos + 1 < line.size() && line[pos + 1] == '"') {
+                        out += '"';
+                        pos += 2;
+                        continue;
+                    }
+                    pos++;
+                    break;
+                }
+                out += line[pos++];
+            }
+            if (pos < line.size() && line[pos] != ',') {
+                return false;
+            }
+        } else {
+            size_t comma = min(line.find(',', pos), line.size());
+            out.assign(line.substr(pos, comma - pos));
+            pos = comma;
+        }
+        if (out.find('|') != string::npos) {
+            return false;
+        }
+        field++;
+        if (pos >= line.size()) {
+            break;
+        }
+        pos++; // skip ','
+    }
+    return field == count;
+}
+
+struct ImportStats {
+    size_t imported = 0;
+    size_t rejected = 0;
+    size_t duplicates = 0;
+};
+
+const uint32_t NO_DATE_KEY = UINT32_MAX;
+
+// A row appended by a bulk import, with its secondary keys as handles in key pools
+struct ImportedRow {
+    string id;
+    long offset;
+    uint32_t key;
+    uint32_t dateKey = NO_DATE_KEY; // appointments: normalised date, if the date has one
+};
+
+// Stream the rows of a three-column CSV file into the data file with large sequential
+// writes. accept(fields, offset) checks a row and records where it is about to be written.
+// A first line whose first field is "id" is taken as a header.
+template <class Accept>
+bool appendCsvRows(const string& csvPath, RecordStore& store, ImportStats& stats, Accept accept) {
+    int fd = ::open(csvPath.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        cerr << "Cannot open " << csvPath << ".\n";
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    size_t size = st.st_size;
+    const char* data = nullptr;
+    if (size > 0) {
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            cerr << "Cannot map " << csvPath << ".\n";
+            ::close(fd);
+            return false;
+        }
+        data = static_cast<const char*>(addr);
+        madvise(addr, size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+
+    SequentialWriter out;
+    bool ok = store.open() && out.open(store.path, true);
+    string fields[3];
+    string record;
+    for (size_t pos = 0; ok && pos < size;) {
+        const char* newline = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+        size_t lineEnd = newline ? newline - data : size;
+        string_view line(data + pos, lineEnd - pos);
+        bool firstLine = pos == 0;
+        pos = lineEnd + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+        bool parsed = parseCsvLine(line, fields, 3);
+        if (parsed && firstLine && fields[0] == "id") {
+            continue;
+        }
+        if (parsed) {
+            record.clear();
+            record.append(fields[0]).append("|").append(fields[1]).append("|").append(fields[2]).append("|");
+        }
+        if (!parsed || fields[0].empty() || fields[0].size() > BPT_MAX_KEY || !store.fits(record) ||
+            !accept(fields, (long)out.written)) {
+            stats.rejected++;
+            continue;
+        }
+        ok = out.write(store.encode(record, slotSizeWithSlack(record.size())));
+        stats.imported++;
+    }
+    ok = out.finish() && ok;
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+    }
+    store.release();
+    if (!ok) {
+        cerr << "Failed to write " << store.path << ".\n";
+    }
+    return ok;
+}
+
+// Order of rows by ID, then by position in the file
+bool rowBefore(const ImportedRow& a, const ImportedRow& b) {
+    return a.id != b.id ? a.id < b.id : a.offset < b.offset;
+}
+
+// Sort imported rows by ID and drop every row whose ID is already indexed or came earlier
+// in the file; the dropped records are tombstoned so their space is reused
+void dropDuplicateRows(vector<ImportedRow>& rows, BPlusTree& primaryIndex, AvailList& availList, ImportStats& stats) {
+    if (!is_sorted(rows.begin(), rows.end(), rowBefore)) {
+        sort(rows.begin(), rows.end(), rowBefore);
+    }
+    bool indexed = primaryIndex.size() > 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        if ((kept > 0 && rows[kept - 1].id == rows[i].id) || (indexed && primaryIndex.contains(rows[i].id))) {
+            string_view fields[3];
+            size_t slotSize;
+            if (availList.store.fieldsAt(rows[i].offset, fields, &slotSize)) {
+                availList.release(rows[i].offset, slotSize);
+            }
+            stats.duplicates++;
+            continue;
+        }
+        if (kept != i) {
+            rows[kept] = std::move(rows[i]);
+        }
+        kept++;
+    }
+    rows.resize(kept);
+    stats.imported -= stats.duplicates;
+}
+
+// Bulk-load the primary tree from rows sorted by ID; the IDs are moved out of the rows
+void loadPrimaryRows(vector<ImportedRow>& rows, BPlusTree& primaryIndex) {
+    vector<pair<string, long>> entries;
+    entries.reserve(rows.size());
+    for (ImportedRow& row : rows) {
+        entries.emplace_back(std::move(row.id), row.offset);
+    }
+    primaryIndex.bulkLoad(entries);
+}
+
+// Add rows, deduplicated, to the doctor name index; row.key is a handle in names
+void indexDoctorRows(const vector<ImportedRow>& rows, const StringPool& names) {
+    vector<vector<string_view>> idsByName(names.size());
+    for (const ImportedRow& row : rows) {
+        idsByName[row.key].push_back(row.id);
+    }
+    for (uint32_t name = 0; name < names.size(); name++) {
+        if (!idsByName[name].empty()) {
+            doctorSecondaryIndex.addAll(string(names[name]), idsByName[name]);
+        }
+    }
+    nameTrigrams.invalidate();
+}
+
+// Add rows, deduplicated, to the doctor ID and date indices; row.key is a handle in
+// doctorIds and row.dateKey one in dates
+void indexAppointmentRows(const vector<ImportedRow>& rows, const StringPool& doctorIds, const StringPool& dates) {
+    vector<vector<uint64_t>> offsetsByDoctor(doctorIds.size());
+    for (const ImportedRow& row : rows) {
+        offsetsByDoctor[row.key].push_back(row.offset);
+    }
+    for (uint32_t doctor = 0; doctor < doctorIds.size(); doctor++) {
+        if (!offsetsByDoctor[doctor].empty()) {
+            sort(offsetsByDoctor[doctor].begin(), offsetsByDoctor[doctor].end());
+            appointmentSecondaryIndex.addAll(string(doctorIds[doctor]), offsetsByDoctor[doctor]);
+        }
+    }
+    vector<vector<uint64_t>> offsetsByDate(dates.size());
+    for (const ImportedRow& row : rows) {
+        if (row.dateKey != NO_DATE_KEY) {
+            offsetsByDate[row.dateKey].push_back(row.offset);
+        }
+    }
+    for (uint32_t date = 0; date < dates.size(); date++) {
+        if (!offsetsByDate[date].empty()) {
+            sort(offsetsByDate[date].begin(), offsetsByDate[date].end());
+            appointmentDateIndex.addAll(string(dates[date]), offsetsByDate[date]);
+        }
+    }
+}
+
+// Rebuild the doctor ID and date indices of appointments in one pass over the data file,
+// after a compaction moved every record. A record is listed if the primary index points at
+// it; the file is read in order, so every list comes out sorted.
+void rebuildAppointmentPostings() {
+    vector<ImportedRow> rows;
+    StringPool doctorIds, dates;
+    string dateKey;
+    if (appointmentStore.remap() && appointmentStore.data) {
+        for (size_t pos = appointmentStore.firstSlot(); pos < appointmentStore.mappedSize;) {
+            string_view fields[3];
+            size_t slotSize;
+            SlotStatus status = appointmentStore.slotAt(pos, fields, slotSize);
+            if (status == SLOT_TRUNCATED || status == SLOT_MALFORMED) {
+                break;
+            }
+            long indexed;
+            if (status == SLOT_OK && appointmentPrimaryIndex.find(fields[0], indexed) && indexed == (long)pos) {
+                rows.push_back(ImportedRow{"", (long)pos, doctorIds.intern(fields[2])});
+                if (normalizeDate(fields[1], dateKey)) {
+                    rows.back().dateKey = dates.intern(dateKey);
+                }
+            }
+            pos += slotSize;
+        }
+    }
+    appointmentSecondaryIndex.reset(PostingTableView());
+    appointmentDateIndex.reset(PostingTableView());
+    indexAppointmentRows(rows, doctorIds, dates);
+    appointmentDateIndexLoaded = true;
+}
+
+void printImportStats(const string& csvPath, const ImportStats& stats, chrono::steady_clock::time_point started) {
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    results() << "Imported " << stats.imported << " rows from " << csvPath << " in " << seconds << " s ("
+         << (seconds > 0 ? stats.imported / seconds : 0) << " rows/s); " << stats.rejected << " rejected, "
+         << stats.duplicates << " duplicate IDs skipped\n";
+}
+
+// Bulk import of doctors from CSV rows "id,name,address". The records are appended first;
+// the indices are then built once from the sorted rows and written out by a checkpoint.
+bool importDoctors(const string& csvPath) {
+    auto started = chrono::steady_clock::now();
+    checkpointIndices();
+    ImportStats stats;
+    vector<ImportedRow> rows;
+    StringPool names;
+    bool ok = appendCsvRows(csvPath, doctorStore, stats, [&](string* fields, long offset) {
+        rows.push_back(ImportedRow{fields[0], offset, names.intern(fields[1])});
+        return true;
+    });
+
+    dropDuplicateRows(rows, doctorPrimaryIndex, doc_availList, stats);
+    indexDoctorRows(rows, names);
+    loadPrimaryRows(rows, doctorPrimaryIndex);
+    checkpointIndices();
+    printImportStats(csvPath, stats, started);
+    return ok;
+}
+
+// Bulk import of appointments from CSV rows "id,date,doctorId". Doctor IDs are checked
+// against one in-memory set built by a single pass over the doctor index.
+bool importAppointments(const string& csvPath) {
+    auto started = chrono::steady_clock::now();
+    checkpointIndices();
+    StringPool doctorIds;
+    doctorPrimaryIndex.forEach([&](string_view id, long) { doctorIds.intern(id); });
+
+    ImportStats stats;
+    vector<ImportedRow> rows;
+    StringPool dates;
+    string dateKey;
+    bool ok = appendCsvRows(csvPath, appointmentStore, stats, [&](string* fields, long offset) {
+        uint32_t doctor;
+        if (!doctorIds.find(fields[2], doctor)) {
+            return false;
+        }
+        rows.push_back(ImportedRow{fields[0], offset, doctor});
+        if (normalizeDate(fields[1], dateKey)) {
+            rows.back().dateKey = dates.intern(dateKey);
+        }
+        return true;
+    });
+
+    dropDuplicateRows(rows, appointmentPrimaryIndex, app_availList, stats);
+    indexAppointmentRows(rows, doctorIds, dates);
+    loadPrimaryRows(rows, appointmentPrimaryIndex);
+    checkpointIndices();
+    printImportStats(csvPath, stats, started);
+    return ok;
+}
+
+// Rows, keys and holes found in one range of a data file by rebuildIndices(); the row keys
+// are handles in this range's own key pools
+struct RebuiltRange {
+    vector<ImportedRow> rows;
+    StringPool keys, dates;
+    vector<pair<long, size_t>> holes;
+    size_t unreadable = 0;
+};
+
+// Scan a data file in parallel ranges for rebuildIndices(): every live record becomes a row
+// keyed by fields[keyField] and, if dateField >= 0, the normalised fields[dateField]; every
+// tombstone becomes a hole. Each range's rows are sorted by ID in parallel and the sorted
+// runs merged pairwise, so rows come out in rowBefore order; the ranges' key pools are
+// merged into keys and dates.
+void scanForRebuild(RecordStore& store, int keyField, int dateField, AvailList& availList, vector<ImportedRow>& rows,
+                    StringPool& keys, StringPool& dates, ImportStats& stats) {
+    if (!store.remap() || !store.data) {
+        return;
+    }
+    bool fixed = store.fixed; // fixed-slot holes are found from the status bytes, not the avail list
+    auto visit = [&](RebuiltRange& range, size_t pos, SlotStatus status, const string_view* fields, size_t slotSize) {
+        string dateKey;
+        if (status == SLOT_DELETED) {
+            if (!fixed) {
+                range.holes.push_back({(long)pos, slotSize});
+            }
+        } else if (status != SLOT_OK || fields[0].empty()) {
+            range.unreadable++;
+        } else {
+            range.rows.push_back(ImportedRow{string(fields[0]), (long)pos, range.keys.intern(fields[keyField])});
+            if (dateField >= 0 && normalizeDate(fields[dateField], dateKey)) {
+                range.rows.back().dateKey = range.dates.intern(dateKey);
+            }
+        }
+    };
+    vector<RebuiltRange> ranges = scanSlots<RebuiltRange>(store, visit);
+    runParallel(ranges.size(), [&](size_t i) { sort(ranges[i].rows.begin(), ranges[i].rows.end(), rowBefore); });
+
+    vector<size_t> runs{0}; // rows[runs[i], runs[i + 1]) is sorted
+    for (RebuiltRange& range : ranges) {
+        vector<uint32_t> keyMap, dateMap;
+        for (uint32_t key = 0; key < range.keys.size(); key++) {
+            keyMap.push_back(keys.intern(range.keys[key]));
+        }
+        for (uint32_t date = 0; date < range.dates.size(); date++) {
+            dateMap.push_back(dates.intern(range.dates[date]));
+        }
+        for (ImportedRow& row : range.rows) {
+            row.key = keyMap[row.key];
+            if (row.dateKey != NO_DATE_KEY) {
+                row.dateKey = dateMap[row.dateKey];
+            }
+            rows.push_back(std::move(row));
+        }
+        runs.push_back(rows.size());
+        for (const auto& hole : range.holes) {
+            availList.insertHole(hole.first, hole.second);
+        }
+        stats.rejected += range.unreadable;
+    }
+    for (size_t width = 1; width + 1 < runs.size(); width *= 2) {
+        size_t pairs = (runs.size() - 1 + 2 * width - 1) / (2 * width);
+        runParallel(pairs, [&](size_t i) {
+            size_t first = 2 * width * i, middle = min(first + width, runs.size() - 1),
+                   last = min(first + 2 * width, runs.size() - 1);
+            inplace_merge(rows.begin() + runs[first], rows.begin() + runs[middle], rows.begin() + runs[last], rowBefore);
+        });
+    }
+    stats.imported = rows.size();
+}
+
+// Rebuild every index and both avail lists from the data files alone, for when the index
+// files are lost or damaged. The delta log is discarded; the result is written as a new
+// checkpoint. A second live record with the same ID is tombstoned, as in an import.
+bool rebuildIndices() {
+    auto started = chrono::steady_clock::now();
+    finishInterruptedCompaction();
+    if (!doctorPrimaryIndex.open() || !appointmentPrimaryIndex.open()) {
+        cerr << "Failed to open primary index.\n";
+        return false;
+    }
+    doctorPrimaryIndex.clear();
+    appointmentPrimaryIndex.clear();
+    doctorSecondaryIndex.reset(PostingTableView());
+    appointmentSecondaryIndex.reset(PostingTableView());
+    appointmentDateIndex.reset(PostingTableView());
+    doc_availList.clear();
+    app_availList.clear();
+
+    ImportStats doctorStats;
+    vector<ImportedRow> rows;
+    StringPool keys, dates;
+    scanForRebuild(doctorStore, 1, -1, doc_availList, rows, keys, dates, doctorStats);
+    dropDuplicateRows(rows, doctorPrimaryIndex, doc_availList, doctorStats);
+    indexDoctorRows(rows, keys);
+    loadPrimaryRows(rows, doctorPrimaryIndex);
+
+    ImportStats appointmentStats;
+    rows.clear();
+    keys.clear();
+    scanForRebuild(appointmentStore, 2, 1, app_availList, rows, keys, dates, appointmentStats);
+    dropDuplicateRows(rows, appointmentPrimaryIndex, app_availList, appointmentStats);
+    indexAppointmentRows(rows, keys, dates);
+    loadPrimaryRows(rows, appointmentPrimaryIndex);
+    appointmentDateIndexLoaded = true;
+
+    // Nothing logged so far predates the rebuild; the checkpoint empties the log
+    checkpointIndices();
+    if (pendingLogEntries > 0) {
+        cerr << "Failed to write the rebuilt indices.\n";
+        return false;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    results() << "Rebuilt indices in " << seconds << " s: " << doctorStats.imported << " doctors, "
+              << appointmentStats.imported << " appointments, "
+              << doc_availList.holeCount() + app_availList.holeCount() << " holes; "
+              << doctorStats.rejected + appointmentStats.rejected << " unreadable records, "
+              << doctorStats.duplicates + appointmentStats.duplicates << " duplicate IDs tombstoned\n";
+    return true;
+}
+
+// Rewrite a data file in the fixed-slot layout with the given field widths, or in the text
+// layout when widths is null, leaving out its free space. The file is left as it was if a
+// record does not fit the widths.
+bool convertDataFile(RecordStore& store, const size_t* widths) {
+    if (!store.remap()) {
+        cerr << "Cannot open " << store.path << ".\n";
+        return false;
+    }
+    string convertPath = store.path + ".convert";
+    SequentialWriter out;
+    bool ok = out.open(convertPath) && (!widths || out.write(fixedHeader(widths)));
+    size_t records = 0;
+    for (size_t pos = store.firstSlot(); ok && pos < store.mappedSize;) {
+        string_view fields[3];
+        size_t slotSize;
+        SlotStatus status = store.slotAt(pos, fields, slotSize);
+        if (status == SLOT_TRUNCATED) {
+            break;
+        }
+        if (status == SLOT_MALFORMED) {
+            cerr << "Malformed record at offset " << pos << " of " << store.path << ".\n";
+            ok = false;
+            break;
+        }
+        if (status == SLOT_OK) {
+            string slot;
+            if (widths) {
+                slot = encodeFixedSlot(fields, widths);
+            } else {
+                string record = string(fields[0]) + "|" + string(fields[1]) + "|" + string(fields[2]) + "|";
+                slot = encodeSlot(record, slotSizeWithSlack(record.size()));
+            }
+            if (slot.empty()) {
+                cerr << "Record " << fields[0] << " of " << store.path << " is too long for the fixed-slot layout.\n";
+                ok = false;
+                break;
+            }
+            ok = out.write(slot);
+            records++;
+        }
+        pos += slotSize;
+    }
+    ok = out.finish() && ok;
+    if (ok) {
+        store.release();
+        ok = rename(convertPath.c_str(), store.path.c_str()) == 0;
+    }
+    if (!ok) {
+        cerr << "Conversion of " << store.path << " failed; the data file is unchanged.\n";
+        unlink(convertPath.c_str());
+        return false;
+    }
+    results() << "Converted " << store.path << " to the " << (widths ? "fixed-slot" : "text") << " layout: "
+              << records << " records\n";
+    return true;
+}
+
+// Convert both data files to the fixed-slot or the text layout, then rebuild the indices,
+// whose offsets all changed. If the rebuild is interrupted, --rebuild-indices finishes it.
+bool convertLayout(bool toFixed) {
+    finishInterruptedCompaction();
+    bool converted = convertDataFile(doctorStore, toFixed ? DOCTOR_FIELD_WIDTHS : nullptr) &&
+                     convertDataFile(appointmentStore, toFixed ? APPOINTMENT_FIELD_WIDTHS : nullptr);
+    return rebuildIndices() && converted;
+}
+
+// Load and save availability list
+void loaddoc_availList() {
+    ifstream file(DOC_AVAIL_LIST_FILE);
+    doc_availList.clear();
+    if (file) {
+        long position;
+        size_t size;
+        while (file >> position >> size) {
+            doc_availList.insertHole(position, size);
+        }
+        file.close();
+    }
+}
+
+// Load and save availability list
+void loadApp_availList() {
+    ifstream file(APP_AVAIL_LIST_FILE);
+    app_availList.clear();
+    if (file) {
+        long position;
+        size_t size;
+        while (file >> position >> size) {
+            app_availList.insertHole(position, size);
+        }
+        file.close();
+    }
+}
+
+void savedoc_availList() {
+    ostringstream file;
+    for (const auto& entry : doc_availList.holes()) {
+        file << entry.first << " " << entry.second << "\n";
+    }
+    writeIndexFile(DOC_AVAIL_LIST_FILE, file.str());
+}
+
+void saveApp_availList() {
+    ostringstream file;
+    for (const auto& entry : app_availList.holes()) {
+        file << entry.first << " " << entry.second << "\n";
+    }
+    writeIndexFile(APP_AVAIL_LIST_FILE, file.str());
+}
+
+
+// Add a doctor to the database
+void addDoctor() {
+    Doctor doctor;
+    cout << "Enter Doctor ID: ";
+    cin >> doctor.id;
+    cout << "Enter Name: ";
+    cin.ignore();
+    getline(cin, doctor.name);
+    cout << "Enter Address: ";
+    getline(cin, doctor.address);
+    insertDoctor(doctor);
+}
+
+void insertDoctor(const Doctor& doctor) {
+    if (doctor.id.size() > BPT_MAX_KEY) {
+        results() << "Doctor ID is too long (at most " << BPT_MAX_KEY << " characters).\n";
+        return;
+    }
+
+    if (doctorPrimaryIndex.contains(doctor.id)) {
+        results() << "Doctor ID already exists.\n";
+        return;
+    }
+
+    // Write to file (Delimited format without newline), reusing the best-fitting hole
+    string doctorRecord = doctor.id + "|" + doctor.name + "|" + doctor.address + "|";
+    if (!doctorStore.fits(doctorRecord)) {
+        results() << "Doctor name or address is too long for the fixed-slot layout.\n";
+        return;
+    }
+    long position = storeRecord(doctorStore, doc_availList, doctorRecord);
+    if (position < 0) {
+        cerr << "Failed to write doctor file.\n";
+        return;
+    }
+
+    primaryPut(doctorPrimaryIndex, "DP", doctor.id, position);
+
+    // Add to secondary index
+    secondaryAdd(doctorSecondaryIndex, "DS", doctor.name, doctor.id);
+    nameTrigrams.addName(doctor.name);
+    results() << "Doctor added successfully.\n";
+}
+
+void addAppointment() {
+    Appointment appointment;
+    cout << "Enter Appointment ID: ";
+    cin >> appointment.id;
+    cout << "Enter Doctor ID: ";
+    cin >> appointment.doctorId;
+    cout << "Enter Appointment Date: ";
+    cin.ignore();
+    getline(cin, appointment.date);
+    insertAppointment(appointment);
+}
+
+void insertAppointment(const Appointment& appointment) {
+    if (appointment.id.size() > BPT_MAX_KEY) {
+        results() << "Appointment ID is too long (at most " << BPT_MAX_KEY << " characters).\n";
+        return;
+    }
+
+    // Check if the appointment ID already exists
+    if (appointmentPrimaryIndex.contains(appointment.id)) {
+        results() << "Appointment ID already exists.\n";
+        return;
+    }
+
+    // Validate if the Doctor ID exists
+    if (!doctorPrimaryIndex.contains(appointment.doctorId)) {
+        results() << "Doctor ID does not exist. Cannot create appointment.\n";
+        return;
+    }
+
+    // Write to file (Delimited format with length prefix), reusing the best-fitting hole
+    string appointmentRecord = appointment.id + "|" + appointment.date + "|" + appointment.doctorId + "|";
+    if (!appointmentStore.fits(appointmentRecord)) {
+        results() << "Appointment date is too long for the fixed-slot layout.\n";
+        return;
+    }
+    long position = storeRecord(appointmentStore, app_availList, appointmentRecord);
+    if (position < 0) {
+        cerr << "Failed to write appointment file.\n";
+        return;
+    }
+
+    primaryPut(appointmentPrimaryIndex, "AP", appointment.id, position); // Update the primary index
+
+    // Add to the secondary index and the date index
+    postingAdd(appointmentSecondaryIndex, "AS", appointment.doctorId, position);
+    dateIndexAdd(appointment.date, position);
+
+    results() << "Appointment added successfully.\n";
+}
+
+int binarySearch(const map<long, size_t>& index, int id) {
+    long start = 0;
+    long end = index.size() - 1;
+    while (start <= end) {
+        long mid = start + (end - start) / 2;
+        if (id == mid) {
+            return index.at(mid);
+        }
+        else if (id > mid) {
+            start = mid + 1;
+        }
+        else {
+            end = mid - 1;
+        }
+    }
+    return -1;
+}
+
+
+// Search for a doctor by ID
+void searchDoctorByID(string_view doctorId) {
+    shared_ptr<const Doctor> doctor = findDoctor(doctorId);
+    if (!doctor) {
+        results() << "Doctor not found.\n";
+        return;
+    }
+
+    results() << "Doctor ID: " << doctor->id << "\n"
+         << "Name: " << doctor->name << "\n"
+         << "Address: " << doctor->address << endl;
+}
+
+// Search for doctors by name; a name containing '%' is a LIKE pattern ('%' stands for any
+// text, '_' for any one character), such as "Jo%" or "%son%"
+void searchDoctorByName(const string& name) {
+    if (name.find('%') != string::npos) {
+        size_t found = 0;
+        forEachNameLike(name, [&](string_view match) {
+            doctorSecondaryIndex.forEachId(string(match), [&](string_view doctorId) {
+                if (found++ == 0) {
+                    results() << "Doctors with a name like " << name << ":\n";
+                }
+                searchDoctorByID(doctorId);
+            });
+        });
+        if (found == 0) {
+            results() << "No doctors found with a name like: " << name << endl;
+        }
+        return;
+    }
+
+    if (!doctorSecondaryIndex.contains(name)) {
+        results() << "No doctors found with the name: " << name << endl;
+        return;
+    }
+
+    results() << "Doctors with the name " << name << ":\n";
+    doctorSecondaryIndex.forEachId(name, [](string_view doctorId) {
+        searchDoctorByID(doctorId);
+    });
+}
 
 // Search for an appointment by ID
-void searchAppointmentByID(const string& appointmentId) {
-    fstream file(APP_FILE);
-    if (!file) {
-        cerr << "Failed to open appointment file.\n";
+void searchAppointmentByID(string_view appointmentId) {
+    shared_ptr<const Appointment> appointment = findAppointment(appointmentId);
+    if (!appointment) {
+        results() << "Appointment not found.\n";
+        return;
+    }
+
+    results() << "Appointment ID: " << appointment->id << "\n"
+         << "Date: " << appointment->date << "\n"
+         << "Doctor ID: " << appointment->doctorId << endl;
+}
+
+// Search for appointments by Doctor ID
+void searchAppointmentByDoctor(const string& doctorId) {
+    if (!appointmentSecondaryIndex.contains(doctorId)) {
+        results() << "No appointments found for Doctor ID: " << doctorId << endl;
+        return;
+    }
+
+    results() << "Appointments for Doctor ID " << doctorId << ":\n";
+    appointmentSecondaryIndex.forEachId(doctorId, [](uint64_t position) {
+        AppointmentView appointment;
+        if (readAppointmentAt(position, appointment)) {
+            results() << "Appointment ID: " << appointment.id << "\n"
+                 << "Date: " << appointment.date << "\n"
+                 << "Doctor ID: " << appointment.doctorId << endl;
+        }
+    });
+}
+
+
+void deleteDoctor(const string& doctorId) {
+
+    long position;
+    if (!doctorPrimaryIndex.find(doctorId, position)) {
+        results() << "Doctor ID not found.\n";
+        return;
+    }
+
+    // Read the record: its name is the secondary key to remove the doctor from
+    DoctorView doctor;
+    size_t slotSize = 0;
+    if (!readDoctorAt(position, doctor, &slotSize)) {
+        cerr << "Error reading doctor record.\n";
+        return;
+    }
+    string name(doctor.name);
+    doctorCache.erase(doctorId);
+
+    // Mark the record as deleted by adding '*' at the beginning of its slot; the slot
+    // becomes free space, merged with any neighbouring holes
+    if (!doc_availList.release(position, slotSize)) {
+        cerr << "Failed to write doctor file.\n";
+        return;
+    }
+    primaryErase(doctorPrimaryIndex, "DP", doctorId);
+
+    // Remove the doctor from the secondary index (by name)
+    secondaryRemove(doctorSecondaryIndex, "DS", name, doctorId);
+
+    results() << "Doctor deleted successfully.\n";
+}
+
+void deleteAppointment(const string& appointmentId) {
+
+    long position;
+    if (!appointmentPrimaryIndex.find(appointmentId, position)) {
+        results() << "Appointment ID not found.\n";
+        return;
+    }
+
+    // Read the record: its doctor ID and date are the secondary keys to remove the appointment from
+    AppointmentView appointment;
+    size_t slotSize = 0;
+    if (!readAppointmentAt(position, appointment, &slotSize)) {
+        cerr << "Error reading appointment record.\n";
+        return;
+    }
+    string doctorId(appointment.doctorId), date(appointment.date);
+    appointmentCache.erase(appointmentId);
+
+    // Mark the record as deleted by adding '*' at the beginning of its slot; the slot
+    // becomes free space, merged with any neighbouring holes
+    if (!app_availList.release(position, slotSize)) {
+        cerr << "Failed to write appointment file.\n";
+        return;
+    }
+    primaryErase(appointmentPrimaryIndex, "AP", appointmentId);
+    postingRemove(appointmentSecondaryIndex, "AS", doctorId, position);
+    dateIndexRemove(date, position);
+
+    results() << "Appointment deleted successfully.\n";
+}
+
+void updateDoctorname(const string& doctorId) {
+    if (!doctorPrimaryIndex.contains(doctorId)) {
+        results() << "Doctor ID not found.\n";
         return;
     }
 
-    if (appointmentPrimaryIndex.find(appointmentId) == appointmentPrimaryIndex.end()) {
-        cout << "Appointment not found.\n";
+    // Prompt user for the new name
+    cout << "Enter new Doctor Name: ";
+    string newName;
+    cin.ignore();
+    getline(cin, newName);
+    renameDoctor(doctorId, newName);
+}
+
+void renameDoctor(const string& doctorId, const string& newName) {
+    long position;
+    if (!doctorPrimaryIndex.find(doctorId, position)) {
+        results() << "Doctor ID not found.\n";
         return;
     }
 
-    long position = appointmentPrimaryIndex[appointmentId];
-    file.seekg(position);
-
-    string appointmentRecord = readDelimitedRecord(file);
-    if (!appointmentRecord.empty()) {
-        istringstream iss(appointmentRecord);
-        string id, date, doctorId;
-        getline(iss, id, '|');
-        getline(iss, date, '|');
-        getline(iss, doctorId, '|');
+    // Parse the current record
+    DoctorView current;
+    size_t slotSize = 0;
+    if (!readDoctorAt(position, current, &slotSize)) {
+        cerr << "Error reading doctor record.\n";
+        return;
+    }
+    string id(current.id), oldName(current.name), address(current.address);
+    doctorCache.erase(doctorId);
 
-        cout << "Appointment ID: " << id << "\n"
-             << "Date: " << date << "\n"
-             << "Doctor ID: " << doctorId << endl;
+    // Create a new record with the updated name and update the file
+    string updatedRecord = id + "|" + newName + "|" + address + "|";
+    if (!doctorStore.fits(updatedRecord)) {
+        results() << "Doctor name is too long for the fixed-slot layout.\n";
+        return;
+    }
+    long oldPosition = position;
+    if (!updateRecord(doctorStore, doc_availList, position, slotSize, updatedRecord)) {
+        cerr << "Failed to write doctor file.\n";
+        return;
+    }
+    if (position != oldPosition) {
+        primaryPut(doctorPrimaryIndex, "DP", doctorId, position);
     }
 
-    file.close();
+    // Update the secondary index
+    secondaryRemove(doctorSecondaryIndex, "DS", oldName, doctorId); // Remove from old name
+    secondaryAdd(doctorSecondaryIndex, "DS", newName, doctorId); // Add to the new name
+    nameTrigrams.addName(newName);
+    results() << "Doctor name updated successfully.\n";
 }
-
-// Search for appointments by Doctor ID
-void searchAppointmentByDoctor(const string& doctorId) {
-    if (appointmentSecondaryIndex.find(doctorId) == appointmentSecondaryIndex.end()) {
-        cout << "No appointments found for Doctor ID: " << doctorId << endl;
+void updateAppointmentDate(const string& appointmentId) {
+    if (!appointmentPrimaryIndex.contains(appointmentId)) {
+        results() << "Appointment ID not found.\n";
         return;
     }
 
-    cout << "Appointments for Doctor ID " << doctorId << ":\n";
-    for (const string& appointmentId : appointmentSecondaryIndex[doctorId]) {
-        searchAppointmentByID(appointmentId);
-    }
+    // Prompt user for the new date
+    cout << "Enter new Appointment Date: ";
+    string newDate;
+    cin.ignore();
+    getline(cin, newDate);
+    changeAppointmentDate(appointmentId, newDate);
 }
 
-
-void deleteDoctor(const string& doctorId) {
-
-    if (doctorPrimaryIndex.find(doctorId) == doctorPrimaryIndex.end()) {
-        cout << "Doctor ID not found.\n";
+void changeAppointmentDate(const string& appointmentId, const string& newDate) {
+    long position;
+    if (!appointmentPrimaryIndex.find(appointmentId, position)) {
+        results() << "Appointment ID not found.\n";
         return;
     }
 
-    long position = doctorPrimaryIndex[doctorId];
-    fstream file(DOCTOR_FILE, ios::in | ios::out);
-    if (!file) {
-        cerr << "Failed to open doctor file.\n";
+    // Parse the current appointment record
+    AppointmentView current;
+    size_t slotSize = 0;
+    if (!readAppointmentAt(position, current, &slotSize)) {
+        cerr << "Error reading appointment record.\n";
         return;
     }
+    string id(current.id), oldDate(current.date), doctorId(current.doctorId);
+    appointmentCache.erase(appointmentId);
 
-    // Move to the position of the record
-    file.seekg(position);
-    string doctorRecord = readDelimitedRecord(file);
-    if (doctorRecord.empty()) {
-        cerr << "Error reading doctor record.\n";
+    // Create a new record with the updated date and update the file; the postings list
+    // the record by offset, so a relocated record is listed again under the new one
+    string updatedRecord = id + "|" + newDate + "|" + doctorId + "|";
+    if (!appointmentStore.fits(updatedRecord)) {
+        results() << "Appointment date is too long for the fixed-slot layout.\n";
+        return;
+    }
+    long oldPosition = position;
+    if (!updateRecord(appointmentStore, app_availList, position, slotSize, updatedRecord)) {
+        cerr << "Failed to write appointment file.\n";
         return;
     }
+    if (position != oldPosition) {
+        primaryPut(appointmentPrimaryIndex, "AP", appointmentId, position);
+        postingRemove(appointmentSecondaryIndex, "AS", doctorId, oldPosition);
+        postingAdd(appointmentSecondaryIndex, "AS", doctorId, position);
+    }
+    dateIndexRemove(oldDate, oldPosition);
+    dateIndexAdd(newDate, position);
+    results() << "Appointment date updated successfully.\n";
+}
+void trim(string& str) {
+    str.erase(0, str.find_first_not_of(" \t\n\r"));
+    str.erase(str.find_last_not_of(" \t\n\r") + 1);
+}
 
-    file.close();
+string toLower(string str) {
+    transform(str.begin(), str.end(), str.begin(), ::tolower);
+    return str;
+}
 
-    file.open(DOCTOR_FILE, ios::in | ios::out);
-
-    // Mark the record as deleted by adding '*' at the beginning
-        // Update the record to mark it as deleted
-    int strLength = doctorRecord.length();
-    string str = to_string(strLength);
-    file.seekp(position); // Move back to the start of the record
-    file.put('*');        // Replace the first character with '*'
-    file.write(str.c_str(), str.size()); // Write the length back
-    file.put('|');        // Write the delimiter back
-    file.write(doctorRecord.c_str(), doctorRecord.size()); // Write the record back
-    doctorPrimaryIndex.erase(doctorId);
-    // Remove the doctor from the secondary index (by name)
-    for (auto& entry : doctorSecondaryIndex) {
-        vector<string>& ids = entry.second;
-        auto it = find(ids.begin(), ids.end(), doctorId);
-        if (it != ids.end()) {
-            ids.erase(it);  // Remove the doctor ID from the list
+// Query engine for the SQL subset accepted by handleQuery:
+//   SELECT (* | ALL | column [, column ...]) FROM table [JOIN table [ON column = column]] [WHERE condition]
+//   condition := term [OR term ...]      term := factor [AND factor ...]
+//   factor    := ( condition ) | column (= | != | < | <= | > | >= | LIKE) 'value'
+//              | column BETWEEN 'value' AND 'value'
+// An EXPLAIN prefix prints the plan instead of running it.
+// Keywords and column names are case-insensitive, values are not. A column can be named
+// with spaces or underscores ("doctor id", doctor_id) or by its short name (id), and
+// qualified by its table (doctors.name). The only join is appointments with doctors on
+// doctor id; in it unqualified names must be unambiguous, except doctor id itself.
+// Ranges on the appointment date compare normalised dates (see normalizeDate) and can use
+// the date index; ranges on other columns compare the text. LIKE patterns on the doctor
+// name can use the name index ('abc%') or the trigram index ('%abc%').
+// A query is parsed once into a plan, an operator tree of projection, filter and access
+// nodes, which is cached by the query text and run by one generic executor.
+
+// The three '|' fields of a table's records and how queries refer to them
+struct TableInfo {
+    string name;
+    RecordStore& store;
+    BPlusTree& primaryIndex;
+    vector<vector<string>> columnNames; // accepted names of each field
+    vector<string> labels;              // output label of each field
+    string noRows;
+    int dateField;                      // field holding a date, -1 if none
+};
 
-            // If no IDs are left, delete the entry from the secondary index
-            if (ids.empty()) {
-                doctorSecondaryIndex.erase(entry.first);
+TableInfo doctorsTable{"doctors", doctorStore, doctorPrimaryIndex,
+                       {{"doctor id", "id"}, {"doctor name", "name"}, {"doctor address", "address"}},
+                       {"Doctor ID", "Name", "Address"}, "No doctors found.\n", -1};
+TableInfo appointmentsTable{"appointments", appointmentStore, appointmentPrimaryIndex,
+                            {{"appointment id", "id"}, {"appointment date", "date"}, {"doctor id"}},
+                            {"Appointment ID", "Date", "Doctor ID"}, "No appointments found.\n", 1};
+
+enum TokenKind { TOKEN_WORD, TOKEN_STRING, TOKEN_SYMBOL, TOKEN_END };
+
+struct Token {
+    TokenKind kind;
+    string text;
+};
+
+// Split a query into words, 'quoted strings' ('' inside quotes is a quote) and symbols
+bool tokenizeQuery(const string& query, vector<Token>& tokens, string& error) {
+    size_t pos = 0;
+    while (pos < query.size()) {
+        unsigned char c = query[pos];
+        if (isspace(c)) {
+            pos++;
+        } else if (isalnum(c) || c == '_') {
+            size_t start = pos;
+            while (pos < query.size() && (isalnum(static_cast<unsigned char>(query[pos])) || query[pos] == '_')) {
+                pos++;
+            }
+            tokens.push_back({TOKEN_WORD, query.substr(start, pos - start)});
+        } else if (c == '\'') {
+            string value;
+            for (pos++;; pos++) {
+                if (pos >= query.size()) {
+                    error = "unterminated string";
+                    return false;
+                }
+                if (query[pos] == '\'') {
+                    if (pos + 1 < query.size() && query[pos + 1] == '\'') {
+                        value += '\'';
+                        pos++;
+                        continue;
+                    }
+                    pos++;
+                    break;
+                }
+                value += query[pos];
             }
-            break;  // Exit the loop once the doctor ID is found and removed
+            tokens.push_back({TOKEN_STRING, value});
+        } else {
+            string symbol = query.substr(pos, 2);
+            if (symbol != "!=" && symbol != "<>" && symbol != "<=" && symbol != ">=") {
+                symbol = query.substr(pos, 1);
+                if (string("=<>*,().").find(c) == string::npos) {
+                    error = "unexpected character '" + symbol + "'";
+                    return false;
+                }
+            }
+            tokens.push_back({TOKEN_SYMBOL, symbol == "<>" ? "!=" : symbol});
+            pos += symbol.size();
         }
     }
+    tokens.push_back({TOKEN_END, ""});
+    return true;
+}
 
-    // Update doc_availList with new length after marking it as deleted
-    size_t recordLength = doctorRecord.length(); // Include the added '*'
-    doc_availList[position] = recordLength + 1;
+// WHERE clause tree
+struct Condition {
+    enum Kind { COMPARE, AND, OR } kind;
+    int column = -1;     // COMPARE: field index
+    string op;           // COMPARE: "=", "!=", "<", "<=", ">", ">=", "between" or "like"
+    string value;        // COMPARE; the lower bound of between
+    string high;         // COMPARE between: the upper bound
+    bool byDate = false; // COMPARE range on a date field: the values are normalised dates
+    vector<unique_ptr<Condition>> children;
+};
 
-    file.close();
-    cout << "Doctor deleted successfully.\n";
+bool isRange(const Condition& condition) {
+    return condition.kind == Condition::COMPARE && condition.op != "=" && condition.op != "!=" && condition.op != "like";
 }
 
-void deleteAppointment(const string& appointmentId) {
+// The keys a range condition accepts, as [from, to); to is empty when there is no upper
+// bound. A string followed by '\0' is the smallest string after it.
+void rangeBounds(const Condition& condition, string& from, string& to) {
+    const string& op = condition.op;
+    from = op == ">" ? condition.value + '\0' : op == ">=" || op == "between" ? condition.value : "";
+    to = op == "<" ? condition.value : op == "<=" ? condition.value + '\0' : op == "between" ? condition.high + '\0' : "";
+}
 
-    if (appointmentPrimaryIndex.find(appointmentId) == appointmentPrimaryIndex.end()) {
-        cout << "Appointment ID not found.\n";
-        return;
+bool inRange(const Condition& condition, string_view key) {
+    const string& op = condition.op;
+    if (op == "between") {
+        return key >= condition.value && key <= condition.high;
     }
+    return op == "<" ? key < condition.value : op == "<=" ? key <= condition.value
+                                             : op == ">" ? key > condition.value : key >= condition.value;
+}
 
-    long position = appointmentPrimaryIndex[appointmentId];
-    fstream file(APP_FILE, ios::in | ios::out);
-    if (!file) {
-        cerr << "Failed to open appointment file.\n";
-        return;
+bool evaluateCondition(const Condition& condition, const string_view* fields) {
+    switch (condition.kind) {
+    case Condition::COMPARE: {
+        string_view field = fields[condition.column];
+        if (condition.op == "like") {
+            return likeMatch(field, condition.value);
+        }
+        if (!isRange(condition)) {
+            return (field == condition.value) == (condition.op == "=");
+        }
+        string key;
+        if (condition.byDate) {
+            if (!normalizeDate(field, key)) {
+                return false; // not a date, so in no date range
+            }
+            field = key;
+        }
+        return inRange(condition, field);
     }
-
-    // Move to the position of the record
-    file.seekg(position);
-    string appRecord = readDelimitedRecord(file);
-    if (appRecord.empty()) {
-        cerr << "Error reading appointment record.\n";
-        return;
+    case Condition::AND:
+        for (const auto& child : condition.children) {
+            if (!evaluateCondition(*child, fields)) {
+                return false;
+            }
+        }
+        return true;
+    case Condition::OR:
+        for (const auto& child : condition.children) {
+            if (evaluateCondition(*child, fields)) {
+                return true;
+            }
+        }
+        return false;
     }
+    return false;
+}
 
-    file.close();
+// Operator tree node. PROJECT is the root; below it an optional FILTER over an index access
+// path, or a TABLE_SCAN that evaluates the condition itself. In a join plan the node below
+// PROJECT is a HASH_JOIN of the appointments and doctors access paths, or an INDEX_JOIN
+// that looks up the doctor of every appointment row. rows and cost are the planner's
+// estimates for the subtree.
+struct PlanNode {
+    enum Kind {
+        PROJECT,
+        FILTER,
+        INDEX_LOOKUP,
+        INDEX_RANGE,
+        INDEX_PATTERN,
+        INDEX_UNION,
+        INDEX_INTERSECT,
+        TABLE_SCAN,
+        HASH_JOIN,
+        INDEX_JOIN
+    } kind;
+    const Condition* condition = nullptr; // FILTER, TABLE_SCAN (null: every row), INDEX_LOOKUP, INDEX_RANGE, INDEX_PATTERN,
+                                          // INDEX_JOIN (doctor fields, null: every doctor)
+    const Condition* residual = nullptr;  // joins: condition on the joined fields, null if none
+    int buildSide = 0;                    // HASH_JOIN: child whose rows are hashed
+    double scanCost = 0;                  // FILTER: cost of the table scan it was chosen over
+    vector<int> columns;                  // PROJECT
+    vector<unique_ptr<PlanNode>> children;
+    double rows = 0;
+    double cost = 0;
+};
 
-    file.open(APP_FILE, ios::in | ios::out);
+// In a join the fields of an appointment come first and those of its doctor follow, so
+// conditions and projections number doctor fields from JOIN_DOCTOR_FIELD
+const int JOIN_DOCTOR_FIELD = 3;
+
+struct QueryPlan {
+    TableInfo* table = nullptr;
+    TableInfo* joined = nullptr; // doctors when joined to table (appointments)
+    unique_ptr<Condition> where;
+    vector<unique_ptr<Condition>> pushedDown; // per-table parts of where, owned for the join nodes
+    unique_ptr<PlanNode> root;
+    size_t plannedRows = 0; // table size the plan was costed for
+    bool explain = false;   // the query started with the EXPLAIN keyword
+};
 
-    // Mark the record as deleted by adding '*' at the beginning
-        // Update the record to mark it as deleted
-    int strLength = appRecord.length();
-    string str = to_string(strLength);
-    file.seekp(position); // Move back to the start of the record
-    file.put('*');        // Replace the first character with '*'
-    file.write(str.c_str(), str.size()); // Write the length back
-    file.put('|');        // Write the delimiter back
-    file.write(appRecord.c_str(), appRecord.size()); // Write the record back
-    appointmentPrimaryIndex.erase(appointmentId);
-    for (auto& entry : appointmentSecondaryIndex) {
-        vector<string>& ids = entry.second;
-        auto it = find(ids.begin(), ids.end(), appointmentId);
-        if (it != ids.end()) {
-            ids.erase(it);  // Remove the doctor ID from the list
+// Cost model, in units of one random page or record read
+const double RANDOM_READ_COST = 1.0;
+const double SCAN_ROW_COST = 0.05;       // one record of a sequential scan
+const double HASH_ROW_COST = 0.02;       // one hash table insert or probe
+const double DEFAULT_SELECTIVITY = 0.05; // equality on a column without statistics
+const double DEFAULT_RANGE_SELECTIVITY = 0.3; // range on a column without an ordered index
+
+// Cardinality statistics of a table, cheap enough to gather on every planning
+struct TableStats {
+    double rows = 0;
+    double distinct[3] = {0, 0, 0}; // distinct values per field, 0 when unknown
+};
 
-            // If no IDs are left, delete the entry from the secondary index
-            if (ids.empty()) {
-                appointmentSecondaryIndex.erase(entry.first);
-            }
-            break;  // Exit the loop once the doctor ID is found and removed
-        }
+TableStats tableStats(const TableInfo& table) {
+    TableStats stats;
+    stats.rows = table.primaryIndex.size();
+    stats.distinct[0] = stats.rows;
+    if (&table == &doctorsTable) {
+        stats.distinct[1] = doctorSecondaryIndex.keyCount();
+    } else {
+        stats.distinct[2] = appointmentSecondaryIndex.keyCount();
     }
+    return stats;
+}
 
-    // Update doc_availList with new length after marking it as deleted
-    size_t recordLength = appRecord.length(); // Include the added '*'
-    app_availList[position] = recordLength + 1;
+// Fields answered by an index: the primary key, doctor name and appointment doctor ID
+bool columnIndexed(const TableInfo& table, int column) {
+    return column == 0 || (&table == &doctorsTable ? column == 1 : column == 2);
+}
 
-    file.close();
-    cout << "Appointment deleted successfully.\n";
+// Estimated fraction of the rows that satisfy condition
+double selectivity(const Condition& condition, const TableStats& stats) {
+    if (isRange(condition)) {
+        // Where the bounds fall among the date index keys
+        string from, to;
+        rangeBounds(condition, from, to);
+        double share = condition.byDate ? appointmentDateIndex.keyShare(from, to) : -1;
+        return share >= 0 ? share : DEFAULT_RANGE_SELECTIVITY;
+    }
+    if (condition.kind == Condition::COMPARE && condition.op == "like") {
+        return DEFAULT_RANGE_SELECTIVITY;
+    }
+    if (condition.kind == Condition::COMPARE) {
+        double distinct = stats.distinct[condition.column];
+        double equal = distinct >= 1 ? 1 / distinct : DEFAULT_SELECTIVITY;
+        return condition.op == "=" ? equal : 1 - equal;
+    }
+    double result = condition.kind == Condition::AND ? 1 : 0;
+    for (const auto& child : condition.children) {
+        double childSelectivity = selectivity(*child, stats);
+        result = condition.kind == Condition::AND ? result * childSelectivity : min(1.0, result + childSelectivity);
+    }
+    return result;
 }
 
-void updateDoctorname(const string& doctorId) {
+// Cheapest index access path yielding a superset of the rows matching condition, or null
+// when only a scan can answer it. A path's cost includes reading its candidate records.
+unique_ptr<PlanNode> bestIndexPath(const TableInfo& table, const Condition& condition, const TableStats& stats) {
+    auto node = make_unique<PlanNode>();
+    if (condition.byDate) {
+        // The date index is ordered, so a range costs a search plus the rows it holds
+        node->kind = PlanNode::INDEX_RANGE;
+        node->condition = &condition;
+        node->rows = stats.rows * selectivity(condition, stats);
+        node->cost = RANDOM_READ_COST * (1 + node->rows);
+        return node;
+    }
+    if (condition.op == "like" && &table == &doctorsTable && condition.column == 1) {
+        // The share of the names in the pattern's prefix range, or holding its rarest trigram
+        string prefix = likePrefix(condition.value);
+        double share = !prefix.empty() ? doctorSecondaryIndex.keyShare(prefix, prefixEnd(prefix))
+                                       : nameTrigrams.share(condition.value);
+        if (share < 0) {
+            return nullptr; // no literal text to look up
+        }
+        node->kind = PlanNode::INDEX_PATTERN;
+        node->condition = &condition;
+        node->rows = stats.rows * share;
+        node->cost = RANDOM_READ_COST * (1 + node->rows * 2); // each ID goes through the primary index
+        return node;
+    }
+    if (condition.kind == Condition::COMPARE) {
+        if (condition.op != "=" || !columnIndexed(table, condition.column)) {
+            return nullptr;
+        }
+        node->kind = PlanNode::INDEX_LOOKUP;
+        node->condition = &condition;
+        node->rows = stats.rows * selectivity(condition, stats);
+        // A doctor name lookup goes through the primary index once per ID it lists
+        bool viaPrimary = &table == &doctorsTable && condition.column == 1;
+        node->cost = RANDOM_READ_COST * (1 + node->rows * (viaPrimary ? 2 : 1));
+        return node;
+    }
 
-   if (doctorPrimaryIndex.find(doctorId) == doctorPrimaryIndex.end()) {
-        cout << "Doctor ID not found.\n";
-        return;
+    vector<unique_ptr<PlanNode>> paths;
+    for (const auto& child : condition.children) {
+        unique_ptr<PlanNode> path = bestIndexPath(table, *child, stats);
+        if (path) {
+            paths.push_back(std::move(path));
+        } else if (condition.kind == Condition::OR) {
+            return nullptr; // one unindexed branch of an OR means scanning anyway
+        }
     }
-    long position = doctorPrimaryIndex[doctorId];
-    fstream file(DOCTOR_FILE, ios::in | ios::out);
-    if (!file) {
-        cerr << "Failed to open doctor file.\n";
-        return;
+    if (paths.empty()) {
+        return nullptr;
+    }
+    if (condition.kind == Condition::AND) {
+        // Either the cheapest single path, or the intersection of them all. A path's cost is
+        // producing its offsets plus one record read per row; the intersection produces and
+        // merges every path's offsets but only reads the records of the rows it keeps.
+        auto cheapest = min_element(paths.begin(), paths.end(), [](const auto& a, const auto& b) {
+            return a->cost < b->cost;
+        });
+        double intersectionCost = 0, intersectionRows = stats.rows;
+        for (const auto& path : paths) {
+            intersectionCost += path->cost - RANDOM_READ_COST * path->rows + SCAN_ROW_COST * path->rows;
+            intersectionRows *= stats.rows > 0 ? path->rows / stats.rows : 0;
+        }
+        intersectionCost += RANDOM_READ_COST * intersectionRows;
+        if (paths.size() == 1 || (*cheapest)->cost <= intersectionCost) {
+            return std::move(*cheapest);
+        }
+        node->kind = PlanNode::INDEX_INTERSECT;
+        node->rows = intersectionRows;
+        node->cost = intersectionCost;
+    } else {
+        node->kind = PlanNode::INDEX_UNION;
+        for (const auto& path : paths) {
+            node->rows += path->rows;
+            node->cost += path->cost;
+        }
+        node->rows = min(node->rows, stats.rows);
     }
+    node->children = std::move(paths);
+    return node;
+}
 
+// Pick the cheaper of the best index path (with a filter for the full condition) and a scan
+unique_ptr<PlanNode> planAccess(const TableInfo& table, const Condition* condition) {
+    TableStats stats = tableStats(table);
+    double matching = stats.rows * (condition ? selectivity(*condition, stats) : 1);
+    double scanCost = stats.rows * SCAN_ROW_COST + matching * RANDOM_READ_COST;
+
+    unique_ptr<PlanNode> access = condition ? bestIndexPath(table, *condition, stats) : nullptr;
+    if (access && access->cost < scanCost) {
+        auto filter = make_unique<PlanNode>();
+        filter->kind = PlanNode::FILTER;
+        filter->condition = condition;
+        filter->rows = min(matching, access->rows);
+        filter->cost = access->cost;
+        filter->scanCost = scanCost;
+        filter->children.push_back(std::move(access));
+        return filter;
+    }
+    access = make_unique<PlanNode>();
+    access->kind = PlanNode::TABLE_SCAN;
+    access->condition = condition;
+    access->rows = matching;
+    access->cost = scanCost;
+    return access;
+}
 
-    file.seekg(position);
-    string doctorRecord = readDelimitedRecord(file);
-    if (doctorRecord.empty()) {
-        cerr << "Error reading doctor record.\n";
-        return;
+// Bit 1 if condition reads appointment fields, bit 2 if it reads doctor fields
+int joinSides(const Condition& condition) {
+    if (condition.kind == Condition::COMPARE) {
+        return condition.column < JOIN_DOCTOR_FIELD ? 1 : 2;
+    }
+    int sides = 0;
+    for (const auto& child : condition.children) {
+        sides |= joinSides(*child);
     }
+    return sides;
+}
 
-    file.close();
+// Deep copy of condition with every field number shifted by offset
+unique_ptr<Condition> copyCondition(const Condition& condition, int offset) {
+    auto copy = make_unique<Condition>();
+    copy->kind = condition.kind;
+    copy->column = condition.kind == Condition::COMPARE ? condition.column + offset : -1;
+    copy->op = condition.op;
+    copy->value = condition.value;
+    copy->high = condition.high;
+    copy->byDate = condition.byDate;
+    for (const auto& child : condition.children) {
+        copy->children.push_back(copyCondition(*child, offset));
+    }
+    return copy;
+}
 
-    file.open(DOCTOR_FILE, ios::in | ios::out);
+// AND of parts, kept by plan; null when there are none
+const Condition* keepConjunction(QueryPlan& plan, vector<unique_ptr<Condition>> parts) {
+    if (parts.empty()) {
+        return nullptr;
+    }
+    if (parts.size() == 1) {
+        plan.pushedDown.push_back(std::move(parts[0]));
+    } else {
+        auto all = make_unique<Condition>();
+        all->kind = Condition::AND;
+        all->children = std::move(parts);
+        plan.pushedDown.push_back(std::move(all));
+    }
+    return plan.pushedDown.back().get();
+}
 
-    // Parse the current record
-    istringstream iss(doctorRecord);
-    string id, oldName, address;
-    getline(iss, id, '|');
-    getline(iss, oldName, '|');
-    getline(iss, address, '|');
+// Join of appointments with their doctors. Conjuncts of the WHERE clause that read one table
+// are pushed down to its access path (an equality on the join key to both); the rest are
+// checked on the joined rows. Then either a hash join over both access paths, building on
+// the side with fewer estimated rows, or, when few appointments qualify, an index nested
+// loop that finds each one's doctor through doctorPrimaryIndex, whichever costs less.
+unique_ptr<PlanNode> planJoin(QueryPlan& plan) {
+    vector<const Condition*> conjuncts;
+    if (plan.where && plan.where->kind == Condition::AND) {
+        for (const auto& child : plan.where->children) {
+            conjuncts.push_back(child.get());
+        }
+    } else if (plan.where) {
+        conjuncts.push_back(plan.where.get());
+    }
+    vector<unique_ptr<Condition>> appointmentParts, doctorParts, residualParts;
+    bool keyFixed = false;
+    for (const Condition* conjunct : conjuncts) {
+        int sides = joinSides(*conjunct);
+        if (conjunct->kind == Condition::COMPARE && conjunct->op == "=" &&
+            (conjunct->column == 2 || conjunct->column == JOIN_DOCTOR_FIELD)) {
+            keyFixed = true;
+            appointmentParts.push_back(copyCondition(*conjunct, 2 - conjunct->column));
+            doctorParts.push_back(copyCondition(*conjunct, -conjunct->column));
+        } else if (sides == 1) {
+            appointmentParts.push_back(copyCondition(*conjunct, 0));
+        } else if (sides == 2) {
+            doctorParts.push_back(copyCondition(*conjunct, -JOIN_DOCTOR_FIELD));
+        } else {
+            residualParts.push_back(copyCondition(*conjunct, 0));
+        }
+    }
+    const Condition* doctorCondition = keepConjunction(plan, std::move(doctorParts));
+    unique_ptr<PlanNode> appointments = planAccess(appointmentsTable, keepConjunction(plan, std::move(appointmentParts)));
+    unique_ptr<PlanNode> doctors = planAccess(doctorsTable, doctorCondition);
+
+    // Every appointment has one doctor, so the join keeps the fraction of appointment rows
+    // whose doctor qualifies; with the key fixed that is the chance the one doctor does.
+    // Residual conditions are not estimated.
+    double doctorRows = doctorsTable.primaryIndex.size();
+    double doctorFraction = keyFixed ? doctors->rows : doctorRows > 0 ? doctors->rows / doctorRows : 0;
+    auto join = make_unique<PlanNode>();
+    join->residual = keepConjunction(plan, std::move(residualParts));
+    join->rows = appointments->rows * min(1.0, doctorFraction);
+    double hashCost = appointments->cost + doctors->cost + (appointments->rows + doctors->rows) * HASH_ROW_COST;
+    // A primary index probe and a doctor record read per appointment
+    double loopCost = appointments->cost + appointments->rows * 2 * RANDOM_READ_COST;
+    if (loopCost < hashCost) {
+        join->kind = PlanNode::INDEX_JOIN;
+        join->condition = doctorCondition;
+        join->cost = loopCost;
+        join->children.push_back(std::move(appointments));
+    } else {
+        join->kind = PlanNode::HASH_JOIN;
+        join->buildSide = doctors->rows <= appointments->rows ? 1 : 0;
+        join->cost = hashCost;
+        join->children.push_back(std::move(appointments));
+        join->children.push_back(std::move(doctors));
+    }
+    return join;
+}
 
-    // Prompt user for the new name
-    cout << "Enter new Doctor Name: ";
-    string newName;
-    cin.ignore();
-    getline(cin, newName);
+// Plan the access path, or join, under a projection of columns
+void planQuery(QueryPlan& plan, const vector<int>& columns) {
+    plan.plannedRows = plan.table->primaryIndex.size();
+    unique_ptr<PlanNode> input = plan.joined ? planJoin(plan) : planAccess(*plan.table, plan.where.get());
+    auto project = make_unique<PlanNode>();
+    project->kind = PlanNode::PROJECT;
+    project->columns = columns;
+    project->rows = input->rows;
+    project->cost = input->cost;
+    project->children.push_back(std::move(input));
+    plan.root = std::move(project);
+}
 
-    // Update the secondary index
-    auto& nameList = doctorSecondaryIndex[oldName];
-    nameList.erase(remove(nameList.begin(), nameList.end(), doctorId), nameList.end()); // Remove from old name
-    if (nameList.empty()) {
-        doctorSecondaryIndex.erase(oldName); // Remove entry if no IDs are left
-    }
-    doctorSecondaryIndex[newName].push_back(doctorId); // Add to the new name
+// Recursive-descent parser over the token list; on failure returns null and sets error
+class QueryParser {
+public:
+    string error;
 
-    // Create a new record with the updated name
-    string updatedRecord =id + "|" + newName + "|" + address + "|";
-    string updatedRecordWithLength = to_string(updatedRecord.size()) + "|" + updatedRecord;
+    explicit QueryParser(vector<Token> queryTokens) : tokens(std::move(queryTokens)) {}
 
-    // Update the file
-    file.seekp(position);
-    file.write(updatedRecordWithLength.c_str(),updatedRecordWithLength.size());
+    unique_ptr<QueryPlan> parse() {
+        auto plan = make_unique<QueryPlan>();
+        plan->explain = acceptKeyword("explain");
+        if (!expectKeyword("select")) {
+            return nullptr;
+        }
+        vector<string> names;
+        if (!acceptSymbol("*") && !acceptKeyword("all")) {
+            do {
+                names.push_back(columnName());
+                if (names.back().empty()) {
+                    return nullptr;
+                }
+            } while (acceptSymbol(","));
+        }
+        if (!expectKeyword("from") || !(table = tableNamed(next().text))) {
+            return nullptr;
+        }
+        if (acceptKeyword("join")) {
+            const TableInfo* other = tableNamed(next().text);
+            if (!other) {
+                return nullptr;
+            }
+            if (other == table) {
+                return fail("only appointments and doctors can be joined");
+            }
+            // Fields are numbered appointments first whichever order the tables are named in
+            table = &appointmentsTable;
+            joined = &doctorsTable;
+            if (acceptKeyword("on") && !parseJoinKey()) {
+                return nullptr;
+            }
+        }
+        plan->table = table;
+        plan->joined = joined;
+
+        vector<int> columns;
+        for (const string& name : names) {
+            columns.push_back(resolveColumn(name));
+            if (columns.back() < 0) {
+                return nullptr;
+            }
+        }
+        if (names.empty()) {
+            // The doctor's ID repeats the appointment's
+            columns = joined ? vector<int>{0, 1, 2, 4, 5} : vector<int>{0, 1, 2};
+        }
+        if (acceptKeyword("where")) {
+            plan->where = parseOr();
+            if (!plan->where) {
+                return nullptr;
+            }
+        }
+        if (peek().kind != TOKEN_END) {
+            return fail("unexpected '" + peek().text + "'");
+        }
+        planQuery(*plan, columns);
+        return plan;
+    }
 
+private:
+    vector<Token> tokens;
+    size_t pos = 0;
+    TableInfo* table = nullptr;
+    TableInfo* joined = nullptr;
 
+    const Token& peek() const { return tokens[pos]; }
+    const Token& next() { return tokens[pos < tokens.size() - 1 ? pos++ : pos]; }
 
-    file.close();
-    cout << "Doctor name updated successfully.\n";
-}
-void updateAppointmentDate(const string& appointmentId) {
-    if (appointmentPrimaryIndex.find(appointmentId) == appointmentPrimaryIndex.end()) {
-        cout << "Appointment ID not found.\n";
-        return;
+    nullptr_t fail(const string& message) {
+        if (error.empty()) {
+            error = message;
+        }
+        return nullptr;
     }
-    long position = appointmentPrimaryIndex[appointmentId];
-    fstream file(APP_FILE, ios::in | ios::out);
-    if (!file) {
-        cerr << "Failed to open appointment file.\n";
-        return;
+
+    static bool isKeyword(const string& word) {
+        static const set<string> keywords = {"select", "from", "where",   "and",  "or",     "all",
+                                             "join",   "on",   "between", "like", "explain"};
+        return keywords.count(toLower(word)) > 0;
     }
 
-    // Read the current appointment record
-    file.seekg(position);
-    string appointmentRecord = readDelimitedRecord(file);
-    if (appointmentRecord.empty()) {
-        cerr << "Error reading appointment record.\n";
-        return;
+    bool acceptKeyword(const string& keyword) {
+        if (peek().kind == TOKEN_WORD && toLower(peek().text) == keyword) {
+            pos++;
+            return true;
+        }
+        return false;
     }
-    file.close();
 
-    file.open(APP_FILE, ios::in | ios::out);
+    bool expectKeyword(const string& keyword) {
+        if (!acceptKeyword(keyword)) {
+            fail("expected " + keyword);
+            return false;
+        }
+        return true;
+    }
 
-    // Parse the current record
-    istringstream iss(appointmentRecord);
-    string id, oldDate, doctorId;
-    getline(iss, id, '|');
-    getline(iss, oldDate, '|');
-    getline(iss, doctorId, '|');
+    bool acceptSymbol(const string& symbol) {
+        if (peek().kind == TOKEN_SYMBOL && peek().text == symbol) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
 
-    // Prompt user for the new date
-    cout << "Enter new Appointment Date: ";
-    string newDate;
-    cin.ignore();
-    getline(cin, newDate);
+    TableInfo* tableNamed(const string& text) {
+        string name = toLower(text);
+        if (name == "doctors") {
+            return &doctorsTable;
+        }
+        if (name == "appointments") {
+            return &appointmentsTable;
+        }
+        return fail("unknown table '" + name + "'");
+    }
 
-    // Create a new record with the updated date
-    string updatedRecord = id + "|" + newDate + "|" + doctorId + "|";
-    string updatedRecordWithLength = to_string(updatedRecord.size()) + "|" + updatedRecord;
+    // One or more words naming a column, normalised to lowercase with single spaces, after
+    // an optional "table." qualifier
+    string columnName() {
+        string name;
+        while (peek().kind == TOKEN_WORD && !isKeyword(peek().text)) {
+            string word = toLower(next().text);
+            replace(word.begin(), word.end(), '_', ' ');
+            name += (name.empty() || name.back() == '.' ? "" : " ") + word;
+            if (name.find('.') == string::npos && acceptSymbol(".")) {
+                name += '.';
+            }
+        }
+        if (name.empty() || name.back() == '.') {
+            fail("expected a column name");
+            return "";
+        }
+        return name;
+    }
 
-    // Update the file
-    file.seekp(position);
-    file.write(updatedRecordWithLength.c_str(), updatedRecordWithLength.size());
+    int resolveColumn(const string& name) {
+        size_t dot = name.find('.');
+        string qualifier = dot == string::npos ? "" : name.substr(0, dot);
+        string column = dot == string::npos ? name : name.substr(dot + 1);
+        const TableInfo* tables[] = {table, joined};
+        vector<int> matches;
+        for (int side = 0; side < 2 && tables[side]; side++) {
+            if (!qualifier.empty() && qualifier != tables[side]->name) {
+                continue;
+            }
+            for (size_t field = 0; field < tables[side]->columnNames.size(); field++) {
+                const vector<string>& accepted = tables[side]->columnNames[field];
+                if (find(accepted.begin(), accepted.end(), column) != accepted.end()) {
+                    matches.push_back(side * JOIN_DOCTOR_FIELD + field);
+                }
+            }
+        }
+        // The join makes the two doctor IDs equal, so either will do
+        if (matches.size() == 2 && matches[0] == 2 && matches[1] == JOIN_DOCTOR_FIELD) {
+            matches.pop_back();
+        }
+        if (matches.size() == 1) {
+            return matches[0];
+        }
+        if (matches.size() > 1) {
+            fail("ambiguous column '" + name + "', qualify it with its table");
+        } else if (!qualifier.empty() && qualifier != table->name && (!joined || qualifier != joined->name)) {
+            fail("unknown table '" + qualifier + "' in column '" + name + "'");
+        } else {
+            fail("unknown column '" + name + "' in " + (qualifier.empty() ? table->name : qualifier) +
+                 (joined && qualifier.empty() ? " or " + joined->name : ""));
+        }
+        return -1;
+    }
 
-    file.close();
-    cout << "Appointment date updated successfully.\n";
-}
-void trim(string& str) {
-    str.erase(0, str.find_first_not_of(" \t\n\r"));
-    str.erase(str.find_last_not_of(" \t\n\r") + 1);
-}
-void getdate(const string& appointmentId) {
-    fstream file(APP_FILE);
-    if (!file) {
-        cerr << "Failed to open appointment file.\n";
-        return;
+    // ON column = column, which must name the two doctor IDs
+    bool parseJoinKey() {
+        int columns[2];
+        for (int i = 0; i < 2; i++) {
+            string name = columnName();
+            if (name.empty() || (columns[i] = resolveColumn(name)) < 0) {
+                return false;
+            }
+            if (i == 0 && !acceptSymbol("=")) {
+                fail("expected = in the join condition");
+                return false;
+            }
+        }
+        if (min(columns[0], columns[1]) != 2 || max(columns[0], columns[1]) != JOIN_DOCTOR_FIELD) {
+            fail("appointments and doctors can only be joined on doctor id");
+            return false;
+        }
+        return true;
     }
 
-    if (appointmentPrimaryIndex.find(appointmentId) == appointmentPrimaryIndex.end()) {
-        cout << "Appointment not found.\n";
-        return;
+    unique_ptr<Condition> parseOr() {
+        return parseList(Condition::OR, "or");
     }
 
-    long position = appointmentPrimaryIndex[appointmentId];
-    file.seekg(position);
+    unique_ptr<Condition> parseAnd() {
+        return parseList(Condition::AND, "and");
+    }
 
-    string appointmentRecord = readDelimitedRecord(file);
-    if (!appointmentRecord.empty()) {
-        istringstream iss(appointmentRecord);
-        string id, date, doctorId;
-        getline(iss, id, '|');
-        getline(iss, date, '|');
-        getline(iss, doctorId, '|');
+    // operand [keyword operand ...], collapsed to the operand when there is only one
+    unique_ptr<Condition> parseList(Condition::Kind kind, const string& keyword) {
+        auto list = make_unique<Condition>();
+        list->kind = kind;
+        do {
+            unique_ptr<Condition> operand = kind == Condition::OR ? parseAnd() : parseFactor();
+            if (!operand) {
+                return nullptr;
+            }
+            list->children.push_back(std::move(operand));
+        } while (acceptKeyword(keyword));
+        return list->children.size() == 1 ? std::move(list->children[0]) : std::move(list);
+    }
 
-        cout << "doctor id: " << id << "\n"
-             << "Date: " << date << "\n";
+    unique_ptr<Condition> parseFactor() {
+        if (acceptSymbol("(")) {
+            unique_ptr<Condition> inner = parseOr();
+            if (inner && !acceptSymbol(")")) {
+                return fail("expected )");
+            }
+            return inner;
+        }
+        string name = columnName();
+        if (name.empty()) {
+            return nullptr;
+        }
+        auto comparison = make_unique<Condition>();
+        comparison->kind = Condition::COMPARE;
+        comparison->column = resolveColumn(name);
+        if (comparison->column < 0) {
+            return nullptr;
+        }
+        if (acceptKeyword("like")) {
+            comparison->op = "like";
+            if (!parseValue(name + " LIKE", comparison->value)) {
+                return nullptr;
+            }
+        } else if (acceptKeyword("between")) {
+            comparison->op = "between";
+            if (!parseValue(name + " BETWEEN", comparison->value) || !expectKeyword("and") ||
+                !parseValue(name + " BETWEEN ... AND", comparison->high)) {
+                return nullptr;
+            }
+        } else {
+            for (const char* op : {"=", "!=", "<", "<=", ">", ">="}) {
+                if (acceptSymbol(op)) {
+                    comparison->op = op;
+                    break;
+                }
+            }
+            if (comparison->op.empty()) {
+                return fail("expected a comparison, BETWEEN or LIKE after " + name);
+            }
+            if (!parseValue(name + " " + comparison->op, comparison->value)) {
+                return nullptr;
+            }
+        }
 
+        // A range on a date field compares normalised dates
+        const TableInfo* owner = comparison->column < JOIN_DOCTOR_FIELD ? table : joined;
+        if (isRange(*comparison) && owner->dateField == comparison->column % JOIN_DOCTOR_FIELD) {
+            comparison->byDate = true;
+            string key;
+            if (!normalizeDate(comparison->value, key)) {
+                return fail("'" + comparison->value + "' is not a date");
+            }
+            comparison->value = key;
+            if (comparison->op == "between") {
+                if (!normalizeDate(comparison->high, key)) {
+                    return fail("'" + comparison->high + "' is not a date");
+                }
+                comparison->high = key;
+            }
+        }
+        return comparison;
     }
 
-    file.close();
+    bool parseValue(const string& after, string& value) {
+        if (peek().kind != TOKEN_STRING && peek().kind != TOKEN_WORD) {
+            fail("expected a quoted value after " + after);
+            return false;
+        }
+        value = next().text;
+        return true;
+    }
+};
+
+// Fields of the live record at position
+bool readRecordFields(RecordStore& store, long position, string_view* fields) {
+    return store.fieldsAt(position, fields);
 }
-void getmultipledates(const string& doctorId) {
-    if (appointmentSecondaryIndex.find(doctorId) == appointmentSecondaryIndex.end()) {
-        cout << "No appointments found for Doctor ID: " << doctorId << endl;
-        return;
+
+// The record at position is a row of the table if the primary index points at it
+bool isIndexedRecord(const TableInfo& table, long position) {
+    string_view fields[3];
+    long indexed;
+    return readRecordFields(table.store, position, fields) && table.primaryIndex.find(fields[0], indexed) &&
+           indexed == position;
+}
+
+// Offsets of the rows with field column equal to value, ascending
+vector<long> indexLookup(const TableInfo& table, int column, const string& value) {
+    vector<long> rows;
+    long position;
+    if (column == 0) {
+        if (table.primaryIndex.find(value, position)) {
+            rows.push_back(position);
+        }
+    } else if (&table == &doctorsTable) {
+        doctorSecondaryIndex.forEachId(value, [&](string_view doctorId) {
+            if (doctorPrimaryIndex.find(doctorId, position)) {
+                rows.push_back(position);
+            }
+        });
+        sort(rows.begin(), rows.end());
+    } else {
+        appointmentSecondaryIndex.forEachId(value, [&](uint64_t offset) { rows.push_back(offset); });
     }
+    return rows;
+}
 
-    cout << "Appointments for Doctor ID " << doctorId << ":\n";
-    for (const string& appointmentId : appointmentSecondaryIndex[doctorId]) {
-        getdate(appointmentId);
+// The compressed posting list an index lookup on the appointments' doctor ID reads
+bool postingLookup(const TableInfo& table, const PlanNode& node, PostingListView& postings) {
+    if (&table != &appointmentsTable || node.kind != PlanNode::INDEX_LOOKUP || node.condition->column == 0) {
+        return false;
     }
+    postings = appointmentSecondaryIndex.postings(node.condition->value);
+    return true;
 }
-void getIDs(const string& doctorId) {
-    fstream file(DOCTOR_FILE);
-    if (!file) {
-        cerr << "Failed to open doctor file.\n";
-        return;
+
+// Offsets of the rows an access or filter node produces, ascending
+vector<long> executeNode(const TableInfo& table, const PlanNode& node) {
+    vector<long> rows;
+    switch (node.kind) {
+    case PlanNode::INDEX_LOOKUP:
+        rows = indexLookup(table, node.condition->column, node.condition->value);
+        break;
+    case PlanNode::INDEX_RANGE: {
+        string from, to;
+        rangeBounds(*node.condition, from, to);
+        appointmentDateIndex.forEachIdInRange(from, to, [&](uint64_t offset) { rows.push_back(offset); });
+        sort(rows.begin(), rows.end()); // each date's offsets are sorted, the dates' are not
+        break;
+    }
+    case PlanNode::INDEX_PATTERN: {
+        long position;
+        forEachNameLike(node.condition->value, [&](string_view name) {
+            doctorSecondaryIndex.forEachId(string(name), [&](string_view doctorId) {
+                if (doctorPrimaryIndex.find(doctorId, position)) {
+                    rows.push_back(position);
+                }
+            });
+        });
+        sort(rows.begin(), rows.end());
+        break;
+    }
+    case PlanNode::INDEX_UNION:
+    case PlanNode::INDEX_INTERSECT: {
+        // Two or more doctor ID lookups are merged on their compressed lists, where an
+        // intersection skips whole blocks; the other children are merged as offset vectors
+        bool unite = node.kind == PlanNode::INDEX_UNION;
+        vector<PostingListView> lists;
+        vector<const PlanNode*> others;
+        for (const auto& child : node.children) {
+            PostingListView postings;
+            if (postingLookup(table, *child, postings)) {
+                lists.push_back(postings);
+            } else {
+                others.push_back(child.get());
+            }
+        }
+        if (lists.size() == 1) {
+            others.clear();
+            for (const auto& child : node.children) {
+                others.push_back(child.get());
+            }
+        }
+        bool merged = lists.size() > 1;
+        if (merged) {
+            vector<uint64_t> offsets = mergePostings(lists, unite);
+            rows.assign(offsets.begin(), offsets.end());
+        }
+        for (const PlanNode* child : others) {
+            vector<long> other = executeNode(table, *child), combined;
+            if (!merged) {
+                rows.swap(other);
+                merged = true;
+                continue;
+            }
+            if (unite) {
+                set_union(rows.begin(), rows.end(), other.begin(), other.end(), back_inserter(combined));
+            } else {
+                set_intersection(rows.begin(), rows.end(), other.begin(), other.end(), back_inserter(combined));
+            }
+            rows.swap(combined);
+        }
+        break;
+    }
+    case PlanNode::TABLE_SCAN: {
+        const Condition* condition = node.condition;
+        rows = scanRecords(table.store, [condition](const string_view* fields) {
+            return !condition || evaluateCondition(*condition, fields);
+        });
+        // Records the primary index does not point at are stale copies, not rows
+        rows.erase(remove_if(rows.begin(), rows.end(), [&](long position) { return !isIndexedRecord(table, position); }),
+                   rows.end());
+        break;
+    }
+    case PlanNode::FILTER:
+        for (long position : executeNode(table, *node.children[0])) {
+            string_view fields[3];
+            if (readRecordFields(table.store, position, fields) && evaluateCondition(*node.condition, fields)) {
+                rows.push_back(position);
+            }
+        }
+        break;
+    case PlanNode::PROJECT:
+    case PlanNode::HASH_JOIN:
+    case PlanNode::INDEX_JOIN:
+        break;
     }
+    return rows;
+}
 
-    if (doctorPrimaryIndex.find(doctorId) == doctorPrimaryIndex.end()) {
-        cout << "Doctor not found.\n";
+// Run a join node, handing the fields of each joined row (appointment then doctor) to emit
+// as soon as the row is formed; joined rows are never collected. Only the hash table of the
+// build side and the offsets produced by the access paths are held in memory.
+template <typename Emit>
+void executeJoin(const PlanNode& join, Emit emit) {
+    string_view fields[2 * JOIN_DOCTOR_FIELD];
+    string_view* doctor = fields + JOIN_DOCTOR_FIELD;
+    auto output = [&]() {
+        if (!join.residual || evaluateCondition(*join.residual, fields)) {
+            emit(fields);
+        }
+    };
+    if (join.kind == PlanNode::INDEX_JOIN) {
+        for (long position : executeNode(appointmentsTable, *join.children[0])) {
+            if (!readRecordFields(appointmentStore, position, fields)) {
+                continue;
+            }
+            // Many appointments share a doctor, so the lookup goes through the record cache
+            shared_ptr<const Doctor> match = findDoctor(fields[2]);
+            if (!match) {
+                continue;
+            }
+            doctor[0] = match->id;
+            doctor[1] = match->name;
+            doctor[2] = match->address;
+            if (!join.condition || evaluateCondition(*join.condition, doctor)) {
+                output();
+            }
+        }
         return;
     }
 
-    long position = doctorPrimaryIndex[doctorId];
-    file.seekg(position);
-
-    string doctorRecord = readDelimitedRecord(file);
-    if (!doctorRecord.empty()) {
-        istringstream iss(doctorRecord);
-        string id, name, address;
-        getline(iss, id, '|');
-        getline(iss, name, '|');
-        getline(iss, address, '|');
-
-        cout << "Doctor ID: " << id << "\n";
+    const TableInfo* tables[] = {&appointmentsTable, &doctorsTable};
+    const int keyField[] = {2, 0};
+    int build = join.buildSide, probe = 1 - build;
+    // Keys are copied: reading a record may remap its store under earlier views
+    unordered_map<string, vector<long>> buildRows;
+    for (long position : executeNode(*tables[build], *join.children[build])) {
+        string_view row[3];
+        if (readRecordFields(tables[build]->store, position, row)) {
+            buildRows[string(row[keyField[build]])].push_back(position);
+        }
+    }
+    string key;
+    for (long position : executeNode(*tables[probe], *join.children[probe])) {
+        string_view* probeFields = fields + probe * JOIN_DOCTOR_FIELD;
+        if (!readRecordFields(tables[probe]->store, position, probeFields)) {
+            continue;
+        }
+        key.assign(probeFields[keyField[probe]]);
+        auto matches = buildRows.find(key);
+        if (matches == buildRows.end()) {
+            continue;
+        }
+        for (long buildPosition : matches->second) {
+            if (readRecordFields(tables[build]->store, buildPosition, fields + build * JOIN_DOCTOR_FIELD)) {
+                output();
+            }
+        }
     }
+}
 
-    file.close();
+// Output label of a field of the plan's rows
+const string& fieldLabel(const QueryPlan& plan, int column) {
+    return column < JOIN_DOCTOR_FIELD ? plan.table->labels[column] : plan.joined->labels[column - JOIN_DOCTOR_FIELD];
 }
-void getMultipleIDs(const string& name) {
 
-    if (doctorSecondaryIndex.find(name) == doctorSecondaryIndex.end()) {
-        cout << "No doctors found with the name: " << name << endl;
-        return;
+// Run a plan and print the projected columns of every row
+void executeQuery(const QueryPlan& plan) {
+    const PlanNode& project = *plan.root;
+    size_t found = 0;
+    auto print = [&](const string_view* fields) {
+        for (int column : project.columns) {
+            results() << fieldLabel(plan, column) << ": " << fields[column] << "\n";
+        }
+        found++;
+    };
+    if (plan.joined) {
+        executeJoin(*project.children[0], print);
+    } else {
+        for (long position : executeNode(*plan.table, *project.children[0])) {
+            string_view fields[3];
+            if (readRecordFields(plan.table->store, position, fields)) {
+                print(fields);
+            }
+        }
     }
-
-    cout << "Doctors with the name " << name << ":\n";
-    for (const string& doctorId : doctorSecondaryIndex[name]) {
-        getIDs(doctorId);
+    if (found == 0) {
+        results() << (plan.joined ? "No rows found.\n" : plan.table->noRows);
     }
 }
-void getAddresses(const string& doctorId) {
-    fstream file(DOCTOR_FILE);
-    if (!file) {
-        cerr << "Failed to open doctor file.\n";
-        return;
-    }
 
-    if (doctorPrimaryIndex.find(doctorId) == doctorPrimaryIndex.end()) {
-        cout << "Doctor not found.\n";
-        return;
+// Condition as query text, with the canonical column names
+string describeCondition(const Condition& condition, const TableInfo& table, const TableInfo* joined = nullptr) {
+    if (condition.kind == Condition::COMPARE) {
+        string column = !joined ? table.columnNames[condition.column][0]
+                        : condition.column < JOIN_DOCTOR_FIELD
+                            ? table.name + "." + table.columnNames[condition.column].back()
+                            : joined->name + "." + joined->columnNames[condition.column - JOIN_DOCTOR_FIELD].back();
+        if (condition.op == "between") {
+            return column + " BETWEEN '" + condition.value + "' AND '" + condition.high + "'";
+        }
+        if (condition.op == "like") {
+            return column + " LIKE '" + condition.value + "'";
+        }
+        return column + " " + condition.op + " '" + condition.value + "'";
     }
-
-    long position = doctorPrimaryIndex[doctorId];
-    file.seekg(position);
-
-    string doctorRecord = readDelimitedRecord(file);
-    if (!doctorRecord.empty()) {
-        istringstream iss(doctorRecord);
-        string id, name, address;
-        getline(iss, id, '|');
-        getline(iss, name, '|');
-        getline(iss, address, '|');
-
-        cout << "Doctor address: " << address << "\n";
+    string text;
+    for (const auto& child : condition.children) {
+        if (!text.empty()) {
+            text += condition.kind == Condition::AND ? " AND " : " OR ";
+        }
+        bool nested = child->kind != Condition::COMPARE;
+        text += (nested ? "(" : "") + describeCondition(*child, table, joined) + (nested ? ")" : "");
     }
-
-    file.close();
+    return text;
 }
-void getMultipleaddress(const string& name) {
 
-    if (doctorSecondaryIndex.find(name) == doctorSecondaryIndex.end()) {
-        cout << "No doctors found with the name: " << name << endl;
-        return;
+void explainNode(const PlanNode& node, const QueryPlan& plan, const TableInfo& table, int depth) {
+    results() << string(depth * 2, ' ');
+    switch (node.kind) {
+    case PlanNode::PROJECT: {
+        results() << "Project:";
+        for (size_t i = 0; i < node.columns.size(); i++) {
+            results() << (i == 0 ? " " : ", ") << fieldLabel(plan, node.columns[i]);
+        }
+        break;
     }
-
-    cout << "Doctors with the name " << name << ":\n";
-    for (const string& doctorId : doctorSecondaryIndex[name]) {
-        getAddresses(doctorId);
+    case PlanNode::FILTER:
+        results() << "Filter: " << describeCondition(*node.condition, table);
+        break;
+    case PlanNode::INDEX_LOOKUP:
+        results() << "Index lookup: " << describeCondition(*node.condition, table)
+                  << (node.condition->column == 0 ? " (primary index)" : " (secondary index)");
+        break;
+    case PlanNode::INDEX_RANGE:
+        results() << "Index range scan: " << describeCondition(*node.condition, table) << " (date index)";
+        break;
+    case PlanNode::INDEX_PATTERN:
+        results() << "Index pattern match: " << describeCondition(*node.condition, table)
+                  << (likePrefix(node.condition->value).empty() ? " (trigram index)" : " (name index prefix range)");
+        break;
+    case PlanNode::INDEX_UNION:
+    case PlanNode::INDEX_INTERSECT: {
+        size_t postingLists = 0;
+        PostingListView postings;
+        for (const auto& child : node.children) {
+            postingLists += postingLookup(table, *child, postings);
+        }
+        results() << (node.kind == PlanNode::INDEX_UNION ? "Index union" : "Index intersection")
+                  << (postingLists > 1 ? " (doctor id postings merged compressed)" : "");
+        break;
     }
-}
-void searchAppointmentfordoctor(const string& appointmentId) {
-    fstream file(APP_FILE);
-    if (!file) {
-        cerr << "Failed to open appointment file.\n";
-        return;
+    case PlanNode::TABLE_SCAN:
+        results() << "Parallel scan of " << table.store.path
+                  << (node.condition ? ": " + describeCondition(*node.condition, table) : "");
+        break;
+    case PlanNode::HASH_JOIN:
+        results() << "Hash join on doctor id, building on " << (node.buildSide == 0 ? "appointments" : "doctors");
+        break;
+    case PlanNode::INDEX_JOIN:
+        results() << "Index nested loop join through the doctor primary index"
+                  << (node.condition ? ", doctors: " + describeCondition(*node.condition, doctorsTable) : "");
+        break;
     }
-
-    if (appointmentPrimaryIndex.find(appointmentId) == appointmentPrimaryIndex.end()) {
-        cout << "Appointment not found.\n";
-        return;
+    if (node.residual) {
+        results() << ", filter: " << describeCondition(*node.residual, *plan.table, plan.joined);
     }
-
-    long position = appointmentPrimaryIndex[appointmentId];
-    file.seekg(position);
-
-    string appointmentRecord = readDelimitedRecord(file);
-    if (!appointmentRecord.empty()) {
-        istringstream iss(appointmentRecord);
-        string id, date, doctorId;
-        getline(iss, id, '|');
-        getline(iss, date, '|');
-        getline(iss, doctorId, '|');
-
-        cout << "Appointment ID: " << id << "\n";
-
+    results() << "  (rows=" << node.rows << " cost=" << node.cost << ")\n";
+    for (size_t i = 0; i < node.children.size(); i++) {
+        // Join inputs are an appointments path and a doctors path; others read their parent's table
+        bool join = node.kind == PlanNode::HASH_JOIN || node.kind == PlanNode::INDEX_JOIN;
+        explainNode(*node.children[i], plan, join ? (i == 0 ? appointmentsTable : doctorsTable) : table, depth + 1);
     }
-
-    file.close();
-}
-void searchAppointment(const string& doctorId) {
-    if (appointmentSecondaryIndex.find(doctorId) == appointmentSecondaryIndex.end()) {
-        cout << "No appointments found for Doctor ID: " << doctorId << endl;
-        return;
+    if (node.kind == PlanNode::FILTER) {
+        results() << string(depth * 2 + 2, ' ') << "Rejected: parallel scan (cost=" << node.scanCost << ")\n";
     }
+}
 
-    cout << "Appointments for Doctor ID " << doctorId << ":\n";
-    for (const string& appointmentId : appointmentSecondaryIndex[doctorId]) {
-        searchAppointmentfordoctor(appointmentId);
+// Print the chosen plan with its estimates and the statistics behind them
+void explainQuery(const QueryPlan& plan) {
+    for (const TableInfo* table : {plan.table, plan.joined}) {
+        if (!table) {
+            continue;
+        }
+        TableStats stats = tableStats(*table);
+        results() << "Table " << table->name << ": " << stats.rows << " rows";
+        for (int column = 1; column < 3; column++) {
+            if (stats.distinct[column] > 0) {
+                results() << ", " << stats.distinct[column] << " distinct " << table->columnNames[column][0] << " ("
+                          << stats.rows / stats.distinct[column] << " rows per key)";
+            }
+        }
+        results() << "\n";
     }
+    explainNode(*plan.root, plan, *plan.table, 0);
 }
-void searchdoctorforappointment(const string& appointmentId) {
-    fstream file(APP_FILE);
-    if (!file) {
-        cerr << "Failed to open appointment file.\n";
-        return;
-    }
 
-    if (appointmentPrimaryIndex.find(appointmentId) == appointmentPrimaryIndex.end()) {
-        cout << "Appointment not found.\n";
-        return;
+// Parsed plans by query text. Plans are immutable once built, so server workers share them.
+const size_t PLAN_CACHE_SIZE = 256;
+mutex planCacheLock;
+unordered_map<string, shared_ptr<const QueryPlan>> planCache;
+
+// Plan for query, parsed on first use; null (with the error printed) if it does not parse
+shared_ptr<const QueryPlan> cachedPlan(const string& query) {
+    {
+        lock_guard<mutex> guard(planCacheLock);
+        auto cached = planCache.find(query);
+        if (cached != planCache.end()) {
+            // Costs were estimated for the table size at planning time; re-plan once it has
+            // more than doubled or halved
+            size_t rows = cached->second->table->primaryIndex.size();
+            size_t planned = cached->second->plannedRows;
+            if (rows <= 2 * planned + 16 && planned <= 2 * rows + 16) {
+                return cached->second;
+            }
+            planCache.erase(cached);
+        }
     }
-
-    long position = appointmentPrimaryIndex[appointmentId];
-    file.seekg(position);
-
-    string appointmentRecord = readDelimitedRecord(file);
-    if (!appointmentRecord.empty()) {
-        istringstream iss(appointmentRecord);
-        string id, date, doctorId;
-        getline(iss, id, '|');
-        getline(iss, date, '|');
-        getline(iss, doctorId, '|');
-
-        cout << "doctor id: " << doctorId << "\n";
-
+    vector<Token> tokens;
+    string error;
+    shared_ptr<const QueryPlan> plan;
+    if (tokenizeQuery(query, tokens, error)) {
+        QueryParser parser(std::move(tokens));
+        plan = parser.parse();
+        error = parser.error;
     }
-
-    file.close();
-}
-void searchdoctor(const string& doctorId) {
-    if (appointmentSecondaryIndex.find(doctorId) == appointmentSecondaryIndex.end()) {
-        cout << "No appointments found for Doctor ID: " << doctorId << endl;
-        return;
+    if (!plan) {
+        results() << "Invalid query: " << error << ".\n";
+        return nullptr;
     }
-
-    cout << "Appointments for Doctor ID " << doctorId << ":\n";
-    for (const string& appointmentId : appointmentSecondaryIndex[doctorId]) {
-        searchdoctorforappointment(appointmentId);
+    lock_guard<mutex> guard(planCacheLock);
+    if (planCache.size() >= PLAN_CACHE_SIZE) {
+        planCache.erase(planCache.begin());
     }
+    planCache.emplace(query, plan);
+    return plan;
 }
 
-
+// Run a query, or with an EXPLAIN prefix show how it would be run
 void handleQuery(const string& query) {
-    // Convert query to lowercase for consistent parsing
-    string lowerQuery = query;
-    transform(lowerQuery.begin(), lowerQuery.end(), lowerQuery.begin(), ::tolower);
-
-    // Basic format validation
-    size_t selectPos = lowerQuery.find("select");
-    size_t fromPos = lowerQuery.find("from");
-    size_t wherePos = lowerQuery.find("where");
-
-
-
-    // Extract sections of the query
-    string field = lowerQuery.substr(selectPos + 7, fromPos - (selectPos + 7)); // Text after "select " up to " from "
-    string tableName = lowerQuery.substr(fromPos + 5, wherePos - (fromPos + 6)); // Text after "from " up to " where "
-    string condition = lowerQuery.substr(wherePos + 6); // Text after "where "
-    trim(field);
-
-
-
-    // Validate the condition format
-    size_t equalPos = condition.find('=');
-    if (equalPos == string::npos) {
-        cout << "Invalid condition format.\n";
-        return;
-    }
-
-    string conditionField = condition.substr(0, equalPos);
-    string conditionValue = condition.substr(equalPos + 1);
-
-    // Ensure condition value has single quotes
-    if (conditionValue.front() == '\'' && conditionValue.back() == '\'') {
-        conditionValue = conditionValue.substr(1, conditionValue.length() - 2); // Remove surrounding quotes
-    } else {
-        cout << "Invalid condition value format (missing quotes).\n";
-        return;
-    }
-    // Dispatch based on table name and field
-    if (tableName == "doctors") {
-        if (conditionField == "doctor id") {
-            if (field == "all") {
-
-                searchDoctorByID(conditionValue);
-            } else {
-                fstream file(DOCTOR_FILE);
-                if (!file) {
-                    cerr << "Failed to open doctor file.\n";
-                    return;
-                }
-
-                if (doctorPrimaryIndex.find(conditionValue) == doctorPrimaryIndex.end()) {
-                    cout << "Doctor not found.\n";
-                    return;
-                }
-
-                long position = doctorPrimaryIndex[conditionValue];
-                file.seekg(position);
-                string doctorRecord = readDelimitedRecord(file);
-                if (!doctorRecord.empty()) {
-                    istringstream iss(doctorRecord);
-                    string id, name, address;
-                    getline(iss, id, '|');
-                    getline(iss, name, '|');
-                    getline(iss, address, '|');
-                    if (field=="doctor name") {
-                        cout << "Doctor Name: " << name << endl;
-                    }
-                    else if (field=="doctor address") {
-                        cout << "Doctor Address: " << address << endl;
-                    }
-                }
-                file.close();
-            }
-        }else if (conditionField=="doctor name") {
-            if (field == "all") {
-                searchDoctorByName(conditionValue);
-            }
-            else if (field=="doctor id") {
-                getMultipleIDs(conditionValue);
-            }
-            else if (field=="doctor address") {
-                getMultipleaddress(conditionValue);
-            }
-
-        }
-    } if (tableName == "appointments") {
-            if (conditionField == "doctor id") {
-                if (field == "all") {
-                    searchAppointmentByDoctor(conditionValue);
-                } else if (field == "appointment date") {
-                    getmultipledates(conditionValue);
-                }
-                else if (field=="appointment id") {
-                    searchAppointment(conditionValue);
-                }
-            } else if (conditionField == "appointment id") {
-                if (field == "all") {
-                    searchAppointmentByID(conditionValue);
-                } else if (field == "doctor id") {
-                    searchdoctor(conditionValue);
-                }
-                else if (field=="appointment date") {
-                    getdate(conditionValue);
-                }
-            } else {
-                cout << "Invalid condition field for Appointments table.\n";
-            }
-        }
-
+    string text = query;
+    trim(text);
+    shared_ptr<const QueryPlan> plan = cachedPlan(text);
+    if (plan && plan->explain) {
+        explainQuery(*plan);
+    } else if (plan) {
+        executeQuery(*plan);
     }
-
-
-
-
-
-
-
+}
 
 // Main menu
 void menu() {
     int choice;
+    loadAllIndices();
     do {
-        loadAllIndices();
         cout << "\nMenu:\n"
              << "1. Add Doctor\n"
              << "2. Search Doctor by ID\n"
@@ -1012,6 +5890,8 @@ void menu() {
              << "9. Update Doctor Name\n"
              << "10. update appointment date\n"
              << "11. query\n"
+             << "12. storage statistics\n"
+             << "13. compact data files\n"
              << "0. exit\n"
              << "Enter your choice: ";
         cin >> choice;
@@ -1102,6 +5982,13 @@ void menu() {
                 handleQuery(query);
             }
             break;
+        case 12:
+            printStorageStats();
+            break;
+        case 13:
+            compactDoctors();
+            compactAppointments();
+            break;
         case 0:
         {
             cout << "Exiting...\n";
@@ -1111,13 +5998,643 @@ void menu() {
         default:
             cout << "Invalid choice, please try again.\n";
         }
+        compactIfFragmented();
+        saveAllIndices();
+    } while (choice != 0);
+    saveAllIndices(true);
+}
+
+// Line-oriented commands shared by batch and server mode. A line is a command, a space
+// and its arguments separated by '|' (the record delimiter, so it cannot occur in a field):
+//   add-doctor id|name|address          add-appointment id|doctorId|date
+//   delete-doctor id                    delete-appointment id
+//   update-doctor-name id|name          update-appointment-date id|date
+//   find-doctor id                      find-doctors-by-name name
+//   find-appointment id                 find-appointments-by-doctor doctorId
+//   query <query text>                  commit
+//   compact                             stats
+// A line starting with "select" or "explain" is taken as a query. Blank lines and lines starting with
+// '#' are skipped.
+enum CommandResult { COMMAND_DONE, COMMAND_SKIPPED, COMMAND_INVALID };
+
+// Commands that only read the indices and data files
+bool isReadOnlyCommand(const string& line) {
+    string command = toLower(line.substr(0, line.find_first_of(" \t")));
+    return command.compare(0, 5, "find-") == 0 || command == "query" || command == "select" || command == "explain" ||
+           command == "stats";
+}
+
+CommandResult runCommand(string line) {
+    trim(line);
+    if (line.empty() || line[0] == '#') {
+        return COMMAND_SKIPPED;
+    }
+    size_t space = line.find_first_of(" \t");
+    string command = line.substr(0, space);
+    string rest = space == string::npos ? "" : line.substr(space + 1);
+    trim(rest);
+    vector<string> args;
+    istringstream fields(rest);
+    for (string field; getline(fields, field, '|');) {
+        trim(field);
+        args.push_back(field);
+    }
+    size_t argCount = args.size();
+
+    if (command == "add-doctor" && argCount == 3) {
+        insertDoctor(Doctor{args[0], args[1], args[2]});
+    } else if (command == "add-appointment" && argCount == 3) {
+        Appointment appointment;
+        appointment.id = args[0];
+        appointment.doctorId = args[1];
+        appointment.date = args[2];
+        insertAppointment(appointment);
+    } else if (command == "delete-doctor" && argCount == 1) {
+        deleteDoctor(args[0]);
+    } else if (command == "delete-appointment" && argCount == 1) {
+        deleteAppointment(args[0]);
+    } else if (command == "update-doctor-name" && argCount == 2) {
+        renameDoctor(args[0], args[1]);
+    } else if (command == "update-appointment-date" && argCount == 2) {
+        changeAppointmentDate(args[0], args[1]);
+    } else if (command == "find-doctor" && argCount == 1) {
+        searchDoctorByID(args[0]);
+    } else if (command == "find-doctors-by-name" && argCount == 1) {
+        searchDoctorByName(args[0]);
+    } else if (command == "find-appointment" && argCount == 1) {
+        searchAppointmentByID(args[0]);
+    } else if (command == "find-appointments-by-doctor" && argCount == 1) {
+        searchAppointmentByDoctor(args[0]);
+    } else if (command == "query" && !rest.empty()) {
+        handleQuery(rest);
+    } else if ((toLower(command) == "select" || toLower(command) == "explain") && !rest.empty()) {
+        handleQuery(line);
+    } else if (command == "commit" && rest.empty()) {
+        compactIfFragmented();
         saveAllIndices();
-    } while (choice != 10);
+    } else if (command == "compact" && rest.empty()) {
+        compactDoctors();
+        compactAppointments();
+    } else if (command == "stats" && rest.empty()) {
+        printStorageStats();
+    } else {
+        return COMMAND_INVALID;
+    }
+    if (!isReadOnlyCommand(line)) {
+        writeCompleted();
+    }
+    return COMMAND_DONE;
+}
+
+// Run a command script without prompts. Changes are synced, and checkpointed, only at
+// "commit" lines and at the end of the script, unless the sync policy asks for more.
+void runBatch(istream& in) {
+    auto started = chrono::steady_clock::now();
+    size_t lineNumber = 0, commands = 0, errors = 0;
+    string line;
+    while (getline(in, line)) {
+        lineNumber++;
+        CommandResult result = runCommand(line);
+        if (result == COMMAND_DONE) {
+            commands++;
+        } else if (result == COMMAND_INVALID) {
+            cerr << "Line " << lineNumber << ": unknown command or wrong arguments: " << line << "\n";
+            errors++;
+        }
+    }
+    compactIfFragmented();
+    saveAllIndices(true);
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    cout << "Batch: " << commands << " commands in " << seconds << " s ("
+         << (seconds > 0 ? commands / seconds : 0) << " commands/s), " << errors << " invalid lines\n";
+}
+
+// Server mode: a fixed pool of worker threads answers command lines (see runCommand) from
+// clients on a Unix socket or a localhost TCP port. Read-only commands run under a shared
+// lock, commands that change the data files, indices or avail lists under an exclusive one.
+// Each request is one line; each reply is the command's output framed as "N|" + N bytes.
+const int SERVER_BACKLOG = 128;
+const int SERVER_POLL_MS = 200;
+
+shared_mutex storageLock;
+mutex writerLock; // taken by writers before storageLock, and held through their checkpoint
+atomic<bool> serverStopping{false};
+
+void stopServer(int) {
+    serverStopping = true;
+}
+
+// Buffered line reader over a socket; gives up when the server stops
+struct SocketReader {
+    int fd;
+    string buffer;
+
+    // Read up to the next delimiter, which is consumed but not returned
+    bool readUntil(char delimiter, string& out) {
+        while (true) {
+            size_t end = buffer.find(delimiter);
+            if (end != string::npos) {
+                out = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                return true;
+            }
+            pollfd ready{fd, POLLIN, 0};
+            int polled = poll(&ready, 1, SERVER_POLL_MS);
+            if (serverStopping) {
+                return false;
+            }
+            if (polled <= 0) {
+                continue;
+            }
+            char chunk[4096];
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n <= 0) {
+                return false;
+            }
+            buffer.append(chunk, n);
+        }
+    }
+
+    bool readLine(string& line) {
+        return readUntil('\n', line);
+    }
+
+    // Read exactly size bytes into out
+    bool readBytes(size_t size, string& out) {
+        while (buffer.size() < size) {
+            char chunk[4096];
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n <= 0) {
+                return false;
+            }
+            buffer.append(chunk, n);
+        }
+        out = buffer.substr(0, size);
+        buffer.erase(0, size);
+        return true;
+    }
+};
+
+bool writeAll(int fd, const string& bytes) {
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n = ::send(fd, bytes.data() + written, bytes.size() - written, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+// "/path" or "unix:/path" is a Unix socket, anything else a TCP port on 127.0.0.1
+int openSocket(const string& address, bool listening) {
+    bool unixSocket = address.find('/') != string::npos;
+    string path = address.compare(0, 5, "unix:") == 0 ? address.substr(5) : address;
+    int fd = socket(unixSocket ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int result;
+    if (unixSocket) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            ::close(fd);
+            return -1;
+        }
+        strcpy(addr.sun_path, path.c_str());
+        if (listening) {
+            unlink(path.c_str());
+            result = ::bind(fd, (sockaddr*)&addr, sizeof(addr));
+        } else {
+            result = connect(fd, (sockaddr*)&addr, sizeof(addr));
+        }
+    } else {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(address.c_str()));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            result = ::bind(fd, (sockaddr*)&addr, sizeof(addr));
+        } else {
+            result = connect(fd, (sockaddr*)&addr, sizeof(addr));
+        }
+    }
+    if (result != 0 || (listening && listen(fd, SERVER_BACKLOG) != 0)) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Run one request under the storage lock and return its framed reply
+string serveRequest(const string& line) {
+    ostringstream output;
+    resultStream = &output;
+    CommandResult result;
+    if (isReadOnlyCommand(line)) {
+        shared_lock<shared_mutex> lock(storageLock);
+        result = runCommand(line);
+    } else {
+        lock_guard<mutex> writing(writerLock);
+        unique_lock<shared_mutex> lock(storageLock);
+        result = runCommand(line);
+        // Persist like the menu does, and map what was appended so that readers, which
+        // share the mappings, never have to remap
+        bool checkpoint = pendingLogEntries >= CHECKPOINT_THRESHOLD && commitWrites(true);
+        if (!checkpoint) {
+            saveAllIndices();
+        }
+        doctorStore.remap();
+        appointmentStore.remap();
+        // A due checkpoint is written under a shared lock, so readers are not held up while
+        // the trees and the snapshot are written; writerLock keeps other writers out until
+        // it is switched in under the exclusive lock
+        if (checkpoint) {
+            lock.unlock();
+            bool written;
+            {
+                shared_lock<shared_mutex> reading(storageLock);
+                written = writeCheckpoint();
+            }
+            lock.lock();
+            if (written) {
+                finishCheckpoint();
+            }
+            refreshFreeSlots();
+        }
+    }
+    resultStream = &cout;
+    if (result == COMMAND_INVALID) {
+        output << "Unknown command or wrong arguments.\n";
+    }
+    string body = output.str();
+    return to_string(body.size()) + "|" + body;
+}
+
+// Connections waiting for a worker
+struct ConnectionQueue {
+    mutex lock;
+    condition_variable ready;
+    deque<int> connections;
+
+    void push(int fd) {
+        lock_guard<mutex> guard(lock);
+        connections.push_back(fd);
+        ready.notify_one();
+    }
+
+    // Next connection, or -1 once the server stops
+    int pop() {
+        unique_lock<mutex> guard(lock);
+        while (connections.empty() && !serverStopping) {
+            ready.wait_for(guard, chrono::milliseconds(SERVER_POLL_MS));
+        }
+        if (connections.empty()) {
+            return -1;
+        }
+        int fd = connections.front();
+        connections.pop_front();
+        return fd;
+    }
+};
+
+void serveConnections(ConnectionQueue& queue) {
+    for (int fd; (fd = queue.pop()) >= 0;) {
+        SocketReader reader{fd, ""};
+        string line;
+        while (reader.readLine(line) && writeAll(fd, serveRequest(line))) {
+        }
+        ::close(fd);
+    }
+}
+
+// Serve until SIGINT or SIGTERM, then write a final checkpoint
+bool runServer(const string& address, size_t workers) {
+    int listenFd = openSocket(address, true);
+    if (listenFd < 0) {
+        cerr << "Cannot listen on " << address << ".\n";
+        return false;
+    }
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    loadAllIndices();
+    doctorStore.remap();
+    appointmentStore.remap();
+
+    ConnectionQueue queue;
+    vector<thread> pool;
+    for (size_t i = 0; i < workers; i++) {
+        pool.emplace_back(serveConnections, ref(queue));
+    }
+    cout << "Serving on " << address << " with " << workers << " workers.\n";
+    while (!serverStopping) {
+        pollfd ready{listenFd, POLLIN, 0};
+        if (poll(&ready, 1, SERVER_POLL_MS) > 0) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                queue.push(fd);
+            }
+        }
+    }
+    ::close(listenFd);
+    for (thread& worker : pool) {
+        worker.join();
+    }
+    saveAllIndices(true);
+    cout << "Server stopped.\n";
+    return true;
+}
+
+// Send one request and wait for its framed reply
+bool sendRequest(int fd, SocketReader& reader, const string& request, string& reply) {
+    string length;
+    if (!writeAll(fd, request + "\n") || !reader.readUntil('|', length) || length.empty() ||
+        length.find_first_not_of("0123456789") != string::npos) {
+        return false;
+    }
+    return reader.readBytes(stoul(length), reply);
+}
+
+// Interactive client: send each line of stdin and print the reply
+bool runClient(const string& address) {
+    int fd = openSocket(address, false);
+    if (fd < 0) {
+        cerr << "Cannot connect to " << address << ".\n";
+        return false;
+    }
+    SocketReader reader{fd, ""};
+    string line, reply;
+    while (getline(cin, line) && sendRequest(fd, reader, line, reply)) {
+        cout << reply;
+    }
+    ::close(fd);
+    return true;
+}
+
+// Load generator: `connections` clients each send `requestsPerConnection` requests taken
+// round-robin from the request file, then report throughput and latency percentiles, for
+// all requests and separately for reads and writes, so that a stall of either shows
+bool runLoadTest(const string& address, size_t connections, size_t requestsPerConnection, const string& requestFile) {
+    ifstream file(requestFile);
+    vector<string> requests;
+    for (string line; getline(file, line);) {
+        trim(line);
+        if (!line.empty() && line[0] != '#') {
+            requests.push_back(line);
+        }
+    }
+    if (requests.empty()) {
+        cerr << "No requests in " << requestFile << ".\n";
+        return false;
+    }
+
+    vector<vector<double>> latencies(connections), writeLatencies(connections);
+    atomic<size_t> failures{0};
+    auto started = chrono::steady_clock::now();
+    vector<thread> clients;
+    for (size_t c = 0; c < connections; c++) {
+        clients.emplace_back([&, c] {
+            int fd = openSocket(address, false);
+            if (fd < 0) {
+                failures += requestsPerConnection;
+                return;
+            }
+            SocketReader reader{fd, ""};
+            string reply;
+            for (size_t i = 0; i < requestsPerConnection; i++) {
+                const string& request = requests[(c + i * connections) % requests.size()];
+                auto sent = chrono::steady_clock::now();
+                if (!sendRequest(fd, reader, request, reply)) {
+                    failures += requestsPerConnection - i;
+                    break;
+                }
+                double latency = chrono::duration<double, micro>(chrono::steady_clock::now() - sent).count();
+                (isReadOnlyCommand(request) ? latencies[c] : writeLatencies[c]).push_back(latency);
+            }
+            ::close(fd);
+        });
+    }
+    for (thread& client : clients) {
+        client.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    vector<double> reads, writes;
+    for (size_t c = 0; c < connections; c++) {
+        reads.insert(reads.end(), latencies[c].begin(), latencies[c].end());
+        writes.insert(writes.end(), writeLatencies[c].begin(), writeLatencies[c].end());
+    }
+    vector<double> all = reads;
+    all.insert(all.end(), writes.begin(), writes.end());
+    auto report = [](vector<double>& sorted) {
+        sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p) { return sorted[min(sorted.size() - 1, size_t(p * sorted.size()))]; };
+        cout << "p50 " << percentile(0.50) << " us, p99 " << percentile(0.99) << " us, max " << sorted.back() << " us";
+    };
+    cout << all.size() << " requests in " << seconds << " s: " << all.size() / seconds << " QPS, ";
+    if (!all.empty()) {
+        report(all);
+        cout << ", ";
+    }
+    cout << failures << " failed\n";
+    if (!reads.empty() && !writes.empty()) {
+        cout << "  " << reads.size() << " reads: ";
+        report(reads);
+        cout << "\n  " << writes.size() << " writes: ";
+        report(writes);
+        cout << "\n";
+    }
+    return failures == 0;
+}
+
+// Bulk-delete benchmark, for an empty directory. The tables are grown by bulk import in
+// steps, doubling from 25000 doctors with two appointments each; after every step,
+// deletes appointments and then deletes doctors, picked at random among the live ones,
+// are run through runCommand and timed, so the per-delete cost can be compared across
+// table sizes. The generated data files are left behind.
+bool runDeleteBenchmark(size_t steps, size_t deletes) {
+    if (ifstream(DOCTOR_FILE) || ifstream(APP_FILE)) {
+        cerr << "The delete benchmark needs a directory without data files.\n";
+        return false;
+    }
+    loadAllIndices();
+    const string doctorCsv = "delete_benchmark_doctors.csv", appointmentCsv = "delete_benchmark_appointments.csv";
+    mt19937 random(42);
+    vector<size_t> liveDoctors, liveAppointments;
+    size_t doctorCount = 0, appointmentCount = 0;
+    ostringstream discarded;
+    bool ok = true;
+
+    for (size_t step = 0, target = 25000; ok && step < steps; step++, target *= 2) {
+        // Four doctors share each name, so the posting lists do not grow with the table
+        ofstream doctors(doctorCsv), appointments(appointmentCsv);
+        for (; doctorCount < target; doctorCount++) {
+            doctors << "D" << doctorCount << ",Name " << doctorCount / 4 << ",Street " << doctorCount << "\n";
+            liveDoctors.push_back(doctorCount);
+            for (int i = 0; i < 2; i++, appointmentCount++) {
+                appointments << "A" << appointmentCount << ",2024-" << 1 + appointmentCount % 12 << "-"
+                             << 1 + appointmentCount % 28 << ",D" << liveDoctors[random() % liveDoctors.size()] << "\n";
+                liveAppointments.push_back(appointmentCount);
+            }
+        }
+        doctors.close();
+        appointments.close();
+        ok = importDoctors(doctorCsv) && importAppointments(appointmentCsv);
+
+        // Time deletes of random live records, with their output discarded
+        auto timeDeletes = [&](const string& command, const string& prefix, vector<size_t>& live) {
+            resultStream = &discarded;
+            auto started = chrono::steady_clock::now();
+            for (size_t i = 0; i < deletes && !live.empty(); i++) {
+                size_t pick = random() % live.size();
+                runCommand(command + " " + prefix + to_string(live[pick]));
+                live[pick] = live.back();
+                live.pop_back();
+                discarded.str("");
+            }
+            resultStream = &cout;
+            return chrono::duration<double, micro>(chrono::steady_clock::now() - started).count() / deletes;
+        };
+        size_t appointmentRows = liveAppointments.size(), doctorRows = liveDoctors.size();
+        double appointmentCost = timeDeletes("delete-appointment", "A", liveAppointments);
+        double doctorCost = timeDeletes("delete-doctor", "D", liveDoctors);
+        saveAllIndices(true);
+        cout << doctorRows << " doctors, " << appointmentRows << " appointments: " << doctorCost
+             << " us per doctor delete, " << appointmentCost << " us per appointment delete\n";
+    }
+    remove(doctorCsv.c_str());
+    remove(appointmentCsv.c_str());
+    return ok;
+}
+
+// Report free space and fragmentation of both data files
+void printStorageStats() {
+    doc_availList.printStats("Doctors", max(doctorStore.endOffset(), 0L));
+    app_availList.printStats("Appointments", max(appointmentStore.endOffset(), 0L));
+    doctorCache.printStats("Doctor");
+    appointmentCache.printStats("Appointment");
+    results() << "Sync policy: "
+              << (syncPolicy == SYNC_EVERY_WRITE ? "every write"
+                  : syncPolicy == SYNC_AT_COMMIT ? "at commit"
+                                                 : "every " + to_string(syncIntervalMs) + " ms")
+              << ", " << syncCount << " syncs\n";
 }
 
 // Main function
-int main() {
-    
+int main(int argc, char* argv[]) {
+    // Leading options, before the mode:
+    //   --cache-mb N              cap the record caches at N MiB
+    //   --sync always|commit|N    sync changes after every write, at commit points or every N ms
+    //   --slack N                 pad new slots by N% of the record, for updates in place
+    while (argc > 2 &&
+           (string(argv[1]) == "--cache-mb" || string(argv[1]) == "--sync" || string(argv[1]) == "--slack")) {
+        string option = argv[1], value = argv[2];
+        if (option == "--slack") {
+            slackPercent = strtoull(value.c_str(), nullptr, 10);
+        } else if (option == "--cache-mb") {
+            size_t limit = strtoull(value.c_str(), nullptr, 10) << 20;
+            doctorCache.setLimit(limit / 2);
+            appointmentCache.setLimit(limit / 2);
+        } else if (value == "always") {
+            syncPolicy = SYNC_EVERY_WRITE;
+        } else if (value == "commit") {
+            syncPolicy = SYNC_AT_COMMIT;
+        } else if (!value.empty() && all_of(value.begin(), value.end(), ::isdigit)) {
+            syncPolicy = SYNC_INTERVAL;
+            syncIntervalMs = stol(value);
+        } else {
+            cerr << "Unknown sync policy " << value << " (expected always, commit or a number of ms).\n";
+            return 1;
+        }
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    string mode = argc > 1 ? argv[1] : "";
+
+    if (mode == "--export-indices") {
+        loadAllIndices();
+        exportIndicesText();
+        return 0;
+    }
+    if (mode == "--import-doctors" || mode == "--import-appointments") {
+        // Options may be combined, e.g. --import-doctors d.csv --import-appointments a.csv
+        loadAllIndices();
+        bool imported = true;
+        for (int i = 1; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            if (option == "--import-doctors") {
+                imported = importDoctors(argv[i + 1]) && imported;
+            } else if (option == "--import-appointments") {
+                imported = importAppointments(argv[i + 1]) && imported;
+            } else {
+                cerr << "Unknown option " << option << ".\n";
+                imported = false;
+            }
+        }
+        saveAllIndices(true);
+        return imported ? 0 : 1;
+    }
+    if (mode == "--batch") {
+        // Script from a file, or from stdin when no file (or "-") is given
+        string script = argc > 2 ? argv[2] : "-";
+        ifstream file;
+        if (script != "-") {
+            file.open(script);
+            if (!file) {
+                cerr << "Cannot open " << script << ".\n";
+                return 1;
+            }
+        }
+        loadAllIndices();
+        runBatch(script == "-" ? cin : file);
+        return 0;
+    }
+    if (mode == "--serve" && argc > 2) {
+        size_t workers = argc > 3 ? atoi(argv[3]) : max(1u, thread::hardware_concurrency());
+        return runServer(argv[2], max<size_t>(1, workers)) ? 0 : 1;
+    }
+    if (mode == "--client" && argc > 2) {
+        return runClient(argv[2]) ? 0 : 1;
+    }
+    if (mode == "--load-test" && argc > 5) {
+        return runLoadTest(argv[2], atoi(argv[3]), atoi(argv[4]), argv[5]) ? 0 : 1;
+    }
+    if (mode == "--delete-benchmark") {
+        size_t steps = argc > 2 ? atoi(argv[2]) : 4;
+        size_t deletes = argc > 3 ? atoi(argv[3]) : 1000;
+        return runDeleteBenchmark(steps, max<size_t>(1, deletes)) ? 0 : 1;
+    }
+    if (mode == "--compact") {
+        loadAllIndices();
+        bool compacted = compactDoctors() && compactAppointments();
+        saveAllIndices(true);
+        return compacted ? 0 : 1;
+    }
+    if (mode == "--rebuild-indices") {
+        return rebuildIndices() ? 0 : 1;
+    }
+    if (mode == "--convert-layout" && argc > 2) {
+        string layout = argv[2];
+        if (layout != "fixed" && layout != "text") {
+            cerr << "Unknown layout " << layout << " (expected fixed or text).\n";
+            return 1;
+        }
+        return convertLayout(layout == "fixed") ? 0 : 1;
+    }
+    if (mode == "--verify-indices") {
+        return verifyIndices() ? 0 : 1;
+    }
+    if (mode == "--check-reads") {
+        return checkRecordReads() ? 0 : 1;
+    }
+
     menu();
 
     return 0;